@@ -0,0 +1,256 @@
+/**
+ * @file matrix2bin.c
+ *
+ * @brief convert a text matrix into the binary format read by summatrix
+ *
+ * @author Hoang (Luan) Truong
+ */
+
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "matrix_bin.h"
+
+
+
+//===========================================================================//
+//=========================== Functions Prototypes ==========================//
+//===========================================================================//
+
+/**
+ * @brief print an error message on the console
+ * @param message the error message to be printed
+ */
+void print_error(char* message);
+
+/**
+ * @brief parse an integer starting at the given position of a buffer,
+ *        the same way the mmap path of summatrix does
+ * @param pos   the position of the first character ('-' or a digit)
+ * @param end   the end of the buffer
+ * @param num   where the number parsed will be stored
+ * @return the position right after the number, or NULL if there is no
+ *         number at the given position
+ */
+const char* scan_int(const char* pos, const char* end, int32_t* num);
+
+/**
+ * @brief count the rows of a text matrix and the most numbers on a row
+ * @param data  the mapped text file
+ * @param size  the size of the text file
+ * @param rows  where the number of rows will be stored
+ * @param cols  where the most numbers found on one row will be stored
+ */
+void measure_matrix(const char* data, size_t size, uint32_t* rows, uint32_t* cols);
+
+/**
+ * @brief write the rows of a text matrix as padded little-endian int32
+ * @param data  the mapped text file
+ * @param size  the size of the text file
+ * @param cols  the number of values to write per row
+ * @param out   the output file
+ * @return true if everything was written
+ */
+bool write_rows(const char* data, size_t size, uint32_t cols, FILE* out);
+
+
+
+
+
+//===========================================================================//
+//                               Main Function                               //
+//===========================================================================//
+
+int main(int argc, char** argv)
+{
+    if (argc != 3)
+    {
+        print_error("Usage: matrix2bin <text matrix> <binary matrix>\n");
+        return 1;
+    }
+
+    int fd = open(*(argv + 1), O_RDONLY);
+    struct stat st;
+    if (fd == -1)
+    {
+        print_error("Error: Unable to open the given file\n");
+        return 1;
+    }
+    if (fstat(fd, &st) == -1)
+    {
+        close(fd);
+        print_error("Error: Unable to open the given file\n");
+        return 1;
+    }
+
+    size_t size = st.st_size;
+    const char* data = "";
+    if (size > 0)
+    {
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            close(fd);
+            print_error("Error: Unable to map the given file\n");
+            return 1;
+        }
+    }
+    close(fd);
+
+    FILE* out = fopen(*(argv + 2), "wb");
+    if (out == NULL)
+    {
+        print_error("Error: Unable to create the output file\n");
+        return 1;
+    }
+
+    matrix_bin_header header;
+    uint32_t rows, cols;
+    measure_matrix(data, size, &rows, &cols);
+    memcpy(header.magic, MATRIX_BIN_MAGIC, sizeof(header.magic));
+    header.rows = htole32(rows);
+    header.cols = htole32(cols);
+
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1
+              && write_rows(data, size, cols, out);
+    ok = (fclose(out) == 0) && ok;
+    if (size > 0)
+    {
+        munmap((void*)data, size);
+    }
+    if (!ok)
+    {
+        print_error("Error: Unable to write the output file\n");
+        return 1;
+    }
+
+    printf("Converted %u rows of %u columns\n", rows, cols);
+    return 0;
+}
+
+
+
+
+
+//===========================================================================//
+//=========================== Functions Definitions =========================//
+//===========================================================================//
+
+
+
+void print_error(char* message)
+{
+    printf("\033[1;31m");           // change text color to red
+    printf("%s", message);          // print the error message
+    printf("\033[0m");              // reset text color
+}
+
+
+
+const char* scan_int(const char* pos, const char* end, int32_t* num)
+{
+    bool negative = (*pos == '-');
+    const char* digits = negative ? pos + 1 : pos;
+
+    if (digits >= end || !isdigit(*digits))
+    {
+        return NULL;
+    }
+
+    uint32_t value = 0;
+    while (digits < end && isdigit(*digits))
+    {
+        value = value * 10 + (uint32_t)(*digits - '0');
+        digits++;
+    }
+    *num = negative ? (int32_t)(0u - value) : (int32_t)value;
+    return digits;
+}
+
+
+
+void measure_matrix(const char* data, size_t size, uint32_t* rows, uint32_t* cols)
+{
+    const char* pos = data;
+    const char* end = data + size;
+    uint32_t count = 0;                 // numbers on the current row
+    int32_t num;
+
+    *rows = 0;
+    *cols = 0;
+    while (pos < end)
+    {
+        if (*pos == '\n')
+        {
+            (*rows)++;
+            count = 0;
+            pos++;
+            continue;
+        }
+        const char* next = (isdigit(*pos) || *pos == '-') ? scan_int(pos, end, &num) : NULL;
+        if (next == NULL)
+        {
+            pos++;
+            continue;
+        }
+        if (++count > *cols)
+        {
+            *cols = count;
+        }
+        pos = next;
+    }
+
+    // a last line without a newline is still a row
+    if (size > 0 && data[size - 1] != '\n')
+    {
+        (*rows)++;
+    }
+}
+
+
+
+bool write_rows(const char* data, size_t size, uint32_t cols, FILE* out)
+{
+    const char* pos = data;
+    const char* end = data + size;
+    int32_t* row = calloc(cols > 0 ? cols : 1, sizeof(int32_t));
+    uint32_t count = 0;                 // numbers on the current row
+    bool ok = (row != NULL);
+    int32_t num;
+
+    while (ok && pos < end)
+    {
+        if (*pos == '\n')
+        {
+            ok = fwrite(row, sizeof(int32_t), cols, out) == cols;
+            memset(row, 0, cols * sizeof(int32_t));
+            count = 0;
+            pos++;
+            continue;
+        }
+        const char* next = (isdigit(*pos) || *pos == '-') ? scan_int(pos, end, &num) : NULL;
+        if (next == NULL)
+        {
+            pos++;
+            continue;
+        }
+        row[count++] = (int32_t)htole32((uint32_t)num);
+        pos = next;
+    }
+    if (ok && size > 0 && data[size - 1] != '\n')
+    {
+        ok = fwrite(row, sizeof(int32_t), cols, out) == cols;
+    }
+
+    free(row);
+    return ok;
+}
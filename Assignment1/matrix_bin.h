@@ -0,0 +1,31 @@
+/**
+ * @file matrix_bin.h
+ *
+ * @brief the binary matrix format shared by matrix2bin and summatrix.
+ *        a file is one header followed by `rows * cols` little-endian
+ *        int32 values, stored row after row. rows shorter than `cols`
+ *        in the text file are padded with zeros, and every text line
+ *        (empty ones included) is one row, so row numbers stay the same.
+ */
+
+#ifndef MATRIX_BIN_H
+#define MATRIX_BIN_H
+
+#include <stdint.h>
+
+#define MATRIX_BIN_MAGIC    "SMTX"      // first 4 bytes of every binary matrix
+#define MATRIX_BIN_EXT      "bin"       // extension of binary matrix files
+
+/**
+ * @brief the header at the start of a binary matrix file.
+ *        all fields are little-endian.
+ */
+typedef struct
+{
+    char        magic[4];               // always MATRIX_BIN_MAGIC
+    uint32_t    rows;                   // number of rows
+    uint32_t    cols;                   // number of int32 values in a row
+}
+matrix_bin_header;
+
+#endif
@@ -10,6 +10,59 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <endian.h>
+
+#include "matrix_bin.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS        // vector kernels can be built on this target
+#endif
+
+
+
+//===========================================================================//
+//=============================== Read Modes ================================//
+//===========================================================================//
+
+/**
+ * @brief the available ways of reading the input file
+ */
+typedef enum
+{
+    MODE_STDIO,         // scan the file with getc/fscanf
+    MODE_MMAP,          // map the file and parse the numbers in place
+    MODE_MMAP_SCALAR,   // same as MODE_MMAP, but never use vector kernels
+}
+read_mode;
+
+
+
+/**
+ * @brief the routines used by the mmap path to find and convert numbers,
+ *        and by the binary path to add up rows. the best one the CPU
+ *        supports is picked at runtime.
+ */
+typedef struct
+{
+    const char* name;
+
+    // find the first '-', digit or newline at or after `pos`
+    const char* (*next_token)(const char* pos, const char* end);
+
+    // convert the run of digits starting at `pos`, return the end of the run
+    const char* (*scan_digits)(const char* pos, const char* end, unsigned int* value);
+
+    // add the non-negative values of a binary row to `sum`,
+    // return true if the row has any negative value
+    bool (*sum_row)(const int32_t* row, size_t count, unsigned int* sum);
+}
+scan_kernel;
 
 
 
@@ -25,6 +78,14 @@
  */
 bool validate_input(int argc, char** argv);
 
+/**
+ * @brief get the read mode from its name
+ * @param name the name of the mode ("stdio", "mmap" or "mmap-scalar")
+ * @param mode where the read mode found will be stored
+ * @return true if the given name is a valid read mode
+ */
+bool parse_read_mode(const char* name, read_mode* mode);
+
 /**
  * @brief get the extension of a file
  * @param filepath path to the file
@@ -45,6 +106,56 @@ void print_warning(int value, unsigned int row_num);
  */
 void print_error(char* message);
 
+/**
+ * @brief calculate the matrix sum by scanning the file with stdio
+ * @param file  the opened input file
+ * @param n     the number of columns to calculate up to
+ * @return the sum calculated
+ */
+unsigned int sum_matrix_stdio(FILE* file, size_t n);
+
+/**
+ * @brief calculate the matrix sum by mapping the file into memory and
+ *        parsing the numbers in place
+ * @param filepath  path to the input file
+ * @param n         the number of columns to calculate up to
+ * @param kernel    the routines used to find and convert the numbers
+ * @param result    where the sum calculated will be stored
+ * @return true if the file could be opened and mapped
+ */
+bool sum_matrix_mmap(const char* filepath, size_t n, const scan_kernel* kernel,
+                     unsigned int* result);
+
+/**
+ * @brief calculate the matrix sum of a binary matrix file made by matrix2bin
+ * @param filepath  path to the binary matrix file
+ * @param n         the number of columns to calculate up to
+ * @param kernel    the routines used to add up the rows
+ * @param result    where the sum calculated will be stored
+ * @return true if the file could be mapped and has a valid layout
+ */
+bool sum_matrix_binary(const char* filepath, size_t n, const scan_kernel* kernel,
+                       unsigned int* result);
+
+/**
+ * @brief pick the fastest scan kernel supported by the running CPU
+ * @param force_scalar  always pick the scalar kernel if true
+ * @return the kernel picked
+ */
+const scan_kernel* select_scan_kernel(bool force_scalar);
+
+/**
+ * @brief parse an integer starting at the given position of a buffer
+ * @param kernel    the routines used to convert the digits
+ * @param pos   the position of the first character ('-' or a digit)
+ * @param end   the end of the buffer
+ * @param num   where the number parsed will be stored
+ * @return the position right after the number, or NULL if there is no
+ *         number at the given position
+ */
+const char* scan_int(const scan_kernel* kernel, const char* pos,
+                     const char* end, int* num);
+
 
 
 
@@ -63,63 +174,48 @@ int main(int argc, char** argv)
 
     // get the input arguments and convert N to integer
     char* filename = *(argv + 1);
-    int n = (int)strtol(*(argv + 2), (char**)NULL, 10);
-
-    FILE* file;                             // the input file
-    
-    file = fopen(filename, "r");            // try open the given file
-    if (file == NULL)                       // show error and return 1 if the unable to open
+    size_t n = strtoull(*(argv + 2), (char**)NULL, 10);   // too big saturates
+    read_mode mode = MODE_STDIO;
+    if (argc == 4)
     {
-        print_error("Error: Unable to open the given file");
-        return 1;
+        parse_read_mode(*(argv + 3), &mode);
     }
 
     unsigned int result = 0;                // the sum to be calculated
-    unsigned int count = 0;                 // keep track of the amount of numbers on a line
-    unsigned int row = 1;                   // current row/line
-    int num;                                // contains the current number read
-    char ch = 0;                            // contains the char read
-    bool ignore = false;                    // ignore the number read if true
-
 
-    while (ch != EOF)
+    if (strcmp(get_file_extension(filename), MATRIX_BIN_EXT) == 0)
     {
-        if (isdigit(ch) || ch == '-')       // if is ch is a number,
-        {                                   
-            ungetc(ch, file);               // then push ch back and scan the whole number
-            fscanf(file, "%d", &num);
-
-            if (!ignore)                    // skip if ignore is set
-            {
-                if (num < 0)
-                {
-                    print_warning(num, row);
-                }
-                else
-                {
-                    result += num;
-                }
-            }
-            // if there are more nums on line than input N, ignore the remaining nums on line
-            if (++count >= n)
-            {
-                ignore = true;
-            }
+        const scan_kernel* kernel = select_scan_kernel(mode == MODE_MMAP_SCALAR);
+        if (!sum_matrix_binary(filename, n, kernel, &result))
+        {
+            print_error("Error: Unable to read the given binary matrix");
+            return 1;
         }
-
-        ch = getc(file);
-
-        if (ch == '\n')                 // if newline detected
+    }
+    else if (mode == MODE_MMAP || mode == MODE_MMAP_SCALAR)
+    {
+        const scan_kernel* kernel = select_scan_kernel(mode == MODE_MMAP_SCALAR);
+        if (!sum_matrix_mmap(filename, n, kernel, &result))
         {
-            row++;                      // increase the row number
-            count = 0;                  // reset the numbers counted
-            ignore = false;             // reset ignore flag
+            print_error("Error: Unable to open the given file");
+            return 1;
         }
     }
+    else
+    {
+        FILE* file;                         // the input file
 
-    fclose(file);                       // close the file
+        file = fopen(filename, "r");        // try open the given file
+        if (file == NULL)                   // show error and return 1 if the unable to open
+        {
+            print_error("Error: Unable to open the given file");
+            return 1;
+        }
+        result = sum_matrix_stdio(file, n);
+        fclose(file);                       // close the file
+    }
 
-    printf("\nSum: %d\n", result);      // print out the result
+    printf("\nSum: %d\n", result);          // print out the result
     return 0;
 }
 
@@ -145,7 +241,7 @@ bool validate_input(int argc, char** argv)
         error_message = "Error: Not enough input arguments\n";
     }
     // if too many arguments
-    else if (argc > 3)
+    else if (argc > 4)
     {
         is_valid = false;
         error_message = "Error: Too many input arguments\n";
@@ -155,12 +251,14 @@ bool validate_input(int argc, char** argv)
     {
         char* filepath = *(argv + 1);
         char* n = *(argv + 2);
+        read_mode mode;
 
-        // check whether the file's extension is txt
-        if (strcmp(get_file_extension(filepath), "txt") != 0)
+        // check whether the file's extension is txt, or bin for binary matrices
+        if (strcmp(get_file_extension(filepath), "txt") != 0 &&
+            strcmp(get_file_extension(filepath), MATRIX_BIN_EXT) != 0)
         {
             is_valid = false;
-            error_message = "Error: Given file is not a text file\n";
+            error_message = "Error: Given file is not a text or binary matrix file\n";
         }
         // check whether the given N parameter is a valid non-negative integer
         else
@@ -174,6 +272,12 @@ bool validate_input(int argc, char** argv)
                 }
             }
         }
+        // check whether the optional read mode is known
+        if (is_valid && argc == 4 && !parse_read_mode(*(argv + 3), &mode))
+        {
+            is_valid = false;
+            error_message = "Error: Read mode must be stdio, mmap or mmap-scalar\n";
+        }
     }
     if (is_valid)
     {
@@ -186,6 +290,28 @@ bool validate_input(int argc, char** argv)
 
 
 
+bool parse_read_mode(const char* name, read_mode* mode)
+{
+    if (strcmp(name, "stdio") == 0)
+    {
+        *mode = MODE_STDIO;
+        return true;
+    }
+    if (strcmp(name, "mmap") == 0)
+    {
+        *mode = MODE_MMAP;
+        return true;
+    }
+    if (strcmp(name, "mmap-scalar") == 0)
+    {
+        *mode = MODE_MMAP_SCALAR;
+        return true;
+    }
+    return false;
+}
+
+
+
 const char* get_file_extension(const char* filepath)
 {
     const char *dot = strrchr(filepath, '.');
@@ -217,3 +343,467 @@ void print_error(char* message)
     printf("%s", message);          // print the error message
     printf("\033[0m");              // reset text color
 }
+
+
+
+unsigned int sum_matrix_stdio(FILE* file, size_t n)
+{
+    unsigned int result = 0;                // the sum to be calculated
+    unsigned int count = 0;                 // keep track of the amount of numbers on a line
+    unsigned int row = 1;                   // current row/line
+    int num;                                // contains the current number read
+    char ch = 0;                            // contains the char read
+    bool ignore = false;                    // ignore the number read if true
+
+
+    while (ch != EOF)
+    {
+        if (isdigit(ch) || ch == '-')       // if is ch is a number,
+        {                                   
+            ungetc(ch, file);               // then push ch back and scan the whole number
+            fscanf(file, "%d", &num);
+
+            if (!ignore)                    // skip if ignore is set
+            {
+                if (num < 0)
+                {
+                    print_warning(num, row);
+                }
+                else
+                {
+                    result += num;
+                }
+            }
+            // if there are more nums on line than input N, ignore the remaining nums on line
+            if (++count >= n)
+            {
+                ignore = true;
+            }
+        }
+
+        ch = getc(file);
+
+        if (ch == '\n')                 // if newline detected
+        {
+            row++;                      // increase the row number
+            count = 0;                  // reset the numbers counted
+            ignore = false;             // reset ignore flag
+        }
+    }
+    return result;
+}
+
+
+
+bool sum_matrix_mmap(const char* filepath, size_t n, const scan_kernel* kernel,
+                     unsigned int* result)
+{
+    int fd = open(filepath, O_RDONLY);
+    struct stat st;
+
+    if (fd == -1 || fstat(fd, &st) == -1)
+    {
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return false;
+    }
+
+    *result = 0;
+    if (st.st_size == 0)                    // nothing to map in an empty file
+    {
+        close(fd);
+        return true;
+    }
+
+    const char* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);                              // the mapping stays valid after close
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+    madvise((void*)data, st.st_size, MADV_SEQUENTIAL);
+
+    const char* pos = data;                 // the current position in the file
+    const char* end = data + st.st_size;    // the end of the file
+    unsigned int count = 0;                 // keep track of the amount of numbers on a line
+    unsigned int row = 1;                   // current row/line
+    int num;                                // contains the current number read
+
+    while ((pos = kernel->next_token(pos, end)) < end)
+    {
+        if (*pos == '\n')                   // if newline detected, start a new row
+        {
+            row++;
+            count = 0;
+            pos++;
+        }
+        else if (count >= n && count > 0)   // the rest of the line is ignored,
+        {                                   // so jump straight to its end
+            pos = memchr(pos, '\n', end - pos);
+            if (pos == NULL)
+            {
+                break;
+            }
+        }
+        else                                // a '-' or a digit
+        {
+            const char* next = scan_int(kernel, pos, end, &num);
+            if (next == NULL)               // a lone '-' is not a number
+            {
+                pos++;
+                continue;
+            }
+            if (num < 0)
+            {
+                print_warning(num, row);
+            }
+            else
+            {
+                *result += num;
+            }
+            count++;
+            pos = next;
+        }
+    }
+
+    munmap((void*)data, st.st_size);
+    return true;
+}
+
+
+
+bool sum_matrix_binary(const char* filepath, size_t n, const scan_kernel* kernel,
+                       unsigned int* result)
+{
+    int fd = open(filepath, O_RDONLY);
+    struct stat st;
+
+    if (fd == -1 || fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(matrix_bin_header))
+    {
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return false;
+    }
+
+    const char* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);                              // the mapping stays valid after close
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+
+    // check the header, and that the file holds exactly rows * cols values.
+    // the product is only taken once division shows it fits, since forged
+    // counts such as 2^31 * 2^31 would wrap around to a small size
+    matrix_bin_header header;
+    memcpy(&header, data, sizeof(header));
+    uint64_t rows = le32toh(header.rows);
+    uint64_t cols = le32toh(header.cols);
+    uint64_t payload = st.st_size - sizeof(header);
+    uint64_t count = payload / sizeof(int32_t);
+    bool fits = payload % sizeof(int32_t) == 0 &&
+                (cols == 0 || rows <= count / cols) &&
+                rows * cols == count;
+    if (memcmp(header.magic, MATRIX_BIN_MAGIC, sizeof(header.magic)) != 0 || !fits)
+    {
+        munmap((void*)data, st.st_size);
+        return false;
+    }
+
+    // like the text paths, the first number of a row is always taken
+    size_t take = n > 0 ? n : 1;
+    if (take > cols)
+    {
+        take = cols;
+    }
+
+    const int32_t* values = (const int32_t*)(data + sizeof(header));
+    *result = 0;
+    if (take == cols)
+    {
+        // every column is taken, so the whole matrix is added in one go
+        if (kernel->sum_row(values, rows * cols, result))
+        {
+            for (size_t i = 0; i < rows * cols; i++)
+            {
+                int value = (int32_t)le32toh(values[i]);
+                if (value < 0)
+                {
+                    print_warning(value, i / cols + 1);
+                }
+            }
+        }
+    }
+    else
+    {
+        for (size_t r = 0; r < rows; r++)
+        {
+            const int32_t* row = values + r * cols;
+            if (kernel->sum_row(row, take, result))
+            {
+                for (size_t c = 0; c < take; c++)
+                {
+                    int value = (int32_t)le32toh(row[c]);
+                    if (value < 0)
+                    {
+                        print_warning(value, r + 1);
+                    }
+                }
+            }
+        }
+    }
+
+    munmap((void*)data, st.st_size);
+    return true;
+}
+
+
+
+const char* scan_int(const scan_kernel* kernel, const char* pos,
+                     const char* end, int* num)
+{
+    bool negative = (*pos == '-');
+    const char* digits = negative ? pos + 1 : pos;
+
+    if (digits >= end || !isdigit(*digits))
+    {
+        return NULL;
+    }
+
+    unsigned int value;
+    digits = kernel->scan_digits(digits, end, &value);
+    *num = negative ? (int)(0u - value) : (int)value;
+    return digits;
+}
+
+
+
+//===========================================================================//
+//=============================== Scan Kernels ==============================//
+//===========================================================================//
+
+
+
+const char* next_token_scalar(const char* pos, const char* end)
+{
+    while (pos < end && *pos != '\n' && *pos != '-' && !isdigit(*pos))
+    {
+        pos++;
+    }
+    return pos;
+}
+
+
+
+const char* scan_digits_scalar(const char* pos, const char* end, unsigned int* value)
+{
+    *value = 0;
+    while (pos < end && (unsigned)(*pos - '0') < 10)
+    {
+        *value = *value * 10 + (unsigned)(*pos - '0');
+        pos++;
+    }
+    return pos;
+}
+
+
+
+bool sum_row_scalar(const int32_t* row, size_t count, unsigned int* sum)
+{
+    bool negative = false;
+    for (size_t i = 0; i < count; i++)
+    {
+        int32_t value = (int32_t)le32toh(row[i]);
+        if (value < 0)
+        {
+            negative = true;
+        }
+        else
+        {
+            *sum += value;
+        }
+    }
+    return negative;
+}
+
+
+
+#ifdef HAVE_X86_KERNELS
+
+// shuffle control to move the first `len` bytes of a vector to its end,
+// loaded at offset `len`; the 0x80 entries clear the bytes in front
+static const int8_t right_align_shuffle[32] =
+{
+    -128, -128, -128, -128, -128, -128, -128, -128,
+    -128, -128, -128, -128, -128, -128, -128, -128,
+       0,    1,    2,    3,    4,    5,    6,    7,
+       8,    9,   10,   11,   12,   13,   14,   15,
+};
+
+
+
+__attribute__((target("sse4.2")))
+const char* next_token_sse42(const char* pos, const char* end)
+{
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i minus = _mm_set1_epi8('-');
+    const __m128i newline = _mm_set1_epi8('\n');
+
+    // classify 16 bytes at a time: digits, '-' and newlines are tokens
+    while (end - pos >= 16)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i*)pos);
+        __m128i value = _mm_sub_epi8(block, zero);
+        __m128i hits = _mm_or_si128(
+            _mm_cmpeq_epi8(_mm_min_epu8(value, nine), value),
+            _mm_or_si128(_mm_cmpeq_epi8(block, minus), _mm_cmpeq_epi8(block, newline)));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(hits);
+        if (mask != 0)
+        {
+            return pos + __builtin_ctz(mask);
+        }
+        pos += 16;
+    }
+    return next_token_scalar(pos, end);
+}
+
+
+
+__attribute__((target("avx2")))
+const char* next_token_avx2(const char* pos, const char* end)
+{
+    const __m256i zero = _mm256_set1_epi8('0');
+    const __m256i nine = _mm256_set1_epi8(9);
+    const __m256i minus = _mm256_set1_epi8('-');
+    const __m256i newline = _mm256_set1_epi8('\n');
+
+    // classify 32 bytes at a time: digits, '-' and newlines are tokens
+    while (end - pos >= 32)
+    {
+        __m256i block = _mm256_loadu_si256((const __m256i*)pos);
+        __m256i value = _mm256_sub_epi8(block, zero);
+        __m256i hits = _mm256_or_si256(
+            _mm256_cmpeq_epi8(_mm256_min_epu8(value, nine), value),
+            _mm256_or_si256(_mm256_cmpeq_epi8(block, minus), _mm256_cmpeq_epi8(block, newline)));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(hits);
+        if (mask != 0)
+        {
+            return pos + __builtin_ctz(mask);
+        }
+        pos += 32;
+    }
+    return next_token_scalar(pos, end);
+}
+
+
+
+__attribute__((target("sse4.2")))
+const char* scan_digits_sse42(const char* pos, const char* end, unsigned int* value)
+{
+    // runs near the end of the file or longer than a vector go the slow way
+    if (end - pos < 16)
+    {
+        return scan_digits_scalar(pos, end, value);
+    }
+
+    __m128i digits = _mm_sub_epi8(_mm_loadu_si128((const __m128i*)pos), _mm_set1_epi8('0'));
+    __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digits, _mm_set1_epi8(9)), digits);
+    unsigned int len = __builtin_ctz(~(unsigned int)_mm_movemask_epi8(is_digit));
+    if (len >= 16)
+    {
+        return scan_digits_scalar(pos, end, value);
+    }
+
+    // right-align the run, then combine the digits pairwise:
+    // 1 digit -> 2 digits -> 4 digits -> 8 digits
+    __m128i aligned = _mm_shuffle_epi8(digits,
+        _mm_loadu_si128((const __m128i*)(right_align_shuffle + len)));
+    __m128i pairs = _mm_maddubs_epi16(aligned, _mm_set1_epi16(0x010A));
+    __m128i quads = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00010064));
+    __m128i octs = _mm_madd_epi16(_mm_packus_epi32(quads, quads), _mm_set1_epi32(0x00012710));
+
+    uint64_t high = (uint32_t)_mm_cvtsi128_si32(octs);
+    uint64_t low = (uint32_t)_mm_extract_epi32(octs, 1);
+    *value = (unsigned int)(high * 100000000u + low);
+    return pos + len;
+}
+
+__attribute__((target("sse4.2")))
+bool sum_row_sse42(const int32_t* row, size_t count, unsigned int* sum)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i total = zero;                   // 4 partial sums
+    __m128i signs = zero;                   // sign bits of every value seen
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i values = _mm_loadu_si128((const __m128i*)(row + i));
+        total = _mm_add_epi32(total, _mm_max_epi32(values, zero));
+        signs = _mm_or_si128(signs, values);
+    }
+    total = _mm_add_epi32(total, _mm_shuffle_epi32(total, 0x4E));
+    total = _mm_add_epi32(total, _mm_shuffle_epi32(total, 0xB1));
+    *sum += (unsigned int)_mm_cvtsi128_si32(total);
+
+    bool negative = _mm_movemask_ps(_mm_castsi128_ps(signs)) != 0;
+    return sum_row_scalar(row + i, count - i, sum) || negative;
+}
+
+
+
+__attribute__((target("avx2")))
+bool sum_row_avx2(const int32_t* row, size_t count, unsigned int* sum)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i total = zero;                   // 8 partial sums
+    __m256i signs = zero;                   // sign bits of every value seen
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i values = _mm256_loadu_si256((const __m256i*)(row + i));
+        total = _mm256_add_epi32(total, _mm256_max_epi32(values, zero));
+        signs = _mm256_or_si256(signs, values);
+    }
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(total),
+                                 _mm256_extracti128_si256(total, 1));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4E));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xB1));
+    *sum += (unsigned int)_mm_cvtsi128_si32(half);
+
+    bool negative = _mm256_movemask_ps(_mm256_castsi256_ps(signs)) != 0;
+    return sum_row_scalar(row + i, count - i, sum) || negative;
+}
+
+#endif
+
+
+
+const scan_kernel* select_scan_kernel(bool force_scalar)
+{
+    static const scan_kernel scalar = { "scalar", next_token_scalar, scan_digits_scalar, sum_row_scalar };
+#ifdef HAVE_X86_KERNELS
+    static const scan_kernel sse42 = { "sse4.2", next_token_sse42, scan_digits_sse42, sum_row_sse42 };
+    static const scan_kernel avx2 = { "avx2", next_token_avx2, scan_digits_sse42, sum_row_avx2 };
+
+    if (!force_scalar)
+    {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("sse4.2"))
+        {
+            return &avx2;
+        }
+        if (__builtin_cpu_supports("sse4.2"))
+        {
+            return &sse42;
+        }
+    }
+#endif
+    return &scalar;
+}
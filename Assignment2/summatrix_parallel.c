@@ -12,9 +12,73 @@
 #include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <errno.h>
 #include <sys/wait.h>
 
 
+#define PARTIAL_ROWS    1024        // send a partial sum every this many rows
+#define BATCH_RECORDS   256         // records sent in one write (one PIPE_BUF)
+
+
+//===========================================================================//
+//============================== Pipe Protocol ==============================//
+//===========================================================================//
+
+/**
+ * @brief the kinds of records a child sends to the parent
+ */
+typedef enum
+{
+    REC_PARTIAL = 1,                // `row` rows done, `value` is the sum so far
+    REC_WARNING,                    // negative `value` found on row `row`
+    REC_DONE,                       // `row` rows done, `value` is the final sum
+    REC_ERROR,                      // the file could not be read
+}
+record_type;
+
+/**
+ * @brief one fixed-size record sent over a pipe. records are batched, so
+ *        a child does far fewer writes than it reads rows
+ */
+typedef struct
+{
+    uint32_t    type;               // a record_type
+    uint32_t    row;                // a row number or a row count
+    int64_t     value;              // a sum or a negative value
+}
+record;
+
+/**
+ * @brief the records a child has not sent yet
+ */
+typedef struct
+{
+    int         fd;                 // write end of the child's pipe
+    size_t      count;              // no. of records waiting
+    record      records[BATCH_RECORDS];
+}
+record_batch;
+
+/**
+ * @brief what the parent knows about one child's file
+ */
+typedef struct
+{
+    const char* filepath;           // the file summed by the child
+    int         fd;                 // read end of the child's pipe
+    size_t      pending;            // bytes of a record read so far
+    uint32_t    rows;               // rows the child reported done
+    uint64_t    sum;                // sum the child reported so far
+    bool        done;               // whether a REC_DONE arrived
+    bool        failed;             // whether a REC_ERROR arrived
+    record      partial;            // a record that is not read in full yet
+}
+child_state;
+
+
 //===========================================================================//
 //============================ Functions Prototypes =========================//
 //===========================================================================//
@@ -37,8 +101,9 @@ const char* get_file_extension(const char* filepath);
  * @brief Print a negative value warning on the console
  * @param value     the negative value
  * @param row_num   the row number where the value is on
+ * @param filename  the file where the value is in
  */
-void print_warning(int value, unsigned int row_num);
+void print_warning(int value, unsigned int row_num, const char* filename);
 
 /**
  * @brief Print an error message on the console and
@@ -52,23 +117,54 @@ void report_error(const char* message, bool exit_program);
  * @brief Calculate the sum of all non-negative numbers in the
  *        matrix in a given text file. If the number of columns
  *        in the matrix exceeds the given number n, then the
- *        calculation will stop at column (n)th
+ *        calculation will stop at column (n)th. The progress, the
+ *        warnings and the result are streamed as records to a pipe
  * @param filepath  the path to the file containing the matrix
  * @param n         the number of columns to calculate up to
- * @return the sum calculated
+ * @param fd        the write end of the pipe to the parent
+ * @return 0 if the whole file was summed, -1 otherwise
  */
-int calculate_matrix_sum(const char* filepath, unsigned int n);
+int calculate_matrix_sum(const char* filepath, unsigned int n, int fd);
 
 /**
- * process the files in parallel and calculate the matrices sums
- * @param i     current counter
- * @param fd    file descriptors
- * @param argc  number of arguments passed in
- * @param args  the input arguments
- * @param n     input number N
+ * @brief Queue one record, and send the batch if it is full
+ * @param batch     the records waiting to be sent
+ * @param type      the kind of record
+ * @param row       the row number or row count
+ * @param value     the sum or negative value
  */
-void process_matrices_parallel(unsigned int i, int fd[][2], unsigned int argc,
-                               char** args, unsigned int n);
+void send_record(record_batch* batch, record_type type, uint32_t row,
+                 int64_t value);
+
+/**
+ * @brief Send all the records waiting in a batch with one write
+ * @param batch     the records waiting to be sent
+ */
+void flush_records(record_batch* batch);
+
+/**
+ * @brief Fork one child per file, each streaming its records to its
+ *        own pipe
+ * @param children  the state of each child, with `filepath` set
+ * @param count     the number of files
+ * @param n         input number N
+ */
+void spawn_children(child_state* children, unsigned int count, unsigned int n);
+
+/**
+ * @brief Multiplex the pipes of all children with poll, printing
+ *        warnings and progress as the records arrive
+ * @param children  the state of each child
+ * @param count     the number of children
+ */
+void collect_records(child_state* children, unsigned int count);
+
+/**
+ * @brief Handle one record received from a child
+ * @param child     the child that sent the record
+ * @param rec       the record received
+ */
+void handle_record(child_state* child, const record* rec);
 
 
 //===========================================================================//
@@ -81,32 +177,32 @@ int main(int argc, char** args)
     validate_input(argc, args);
 
     unsigned int num_of_files = argc - 2;
-    unsigned int result = 0;
+    uint64_t result = 0;
     unsigned int n = (int)strtol(args[argc - 1], (char**)NULL, 10);
+    child_state children[num_of_files];
 
-    // create pipes for the input files
-    // each pipe will connect 2 input files
-    int fd[argc][2];
+    // one pipe per input file, each one read by the parent
+    memset(children, 0, sizeof(children));
     for (unsigned int i = 0; i < num_of_files; i++)
     {
-        if (pipe(fd[i]) < 0) report_error("Pipe Failed", true);
+        children[i].filepath = args[i + 1];
     }
 
-    // process the matrices in parallel
-    process_matrices_parallel(num_of_files, fd, argc, args, n);
+    // process the matrices in parallel and follow their progress
+    spawn_children(children, num_of_files, n);
+    collect_records(children, num_of_files);
+    while (wait(NULL) > 0);
 
     // add up all the matrices' sums calculated
     for (unsigned int i = 0; i < num_of_files; i++)
     {
-        int sum_calculated;
-        read(fd[i][0], &sum_calculated, sizeof(sum_calculated));
         // exit with status code 1 if there exists a failed matrix sum
-        if (sum_calculated == -1) return 1;
+        if (children[i].failed || !children[i].done) return 1;
         // otherwise, add the sum calculated to the result
-        result += sum_calculated;
+        result += children[i].sum;
     }
 
-    printf("Total sum: %d", result);
+    printf("Total sum: %" PRIu64 "\n", result);
 
     return 0;
 }
@@ -157,14 +253,14 @@ const char* get_file_extension(const char* filepath)
 }
 
 
-void print_warning(int value, unsigned int row_num)
+void print_warning(int value, unsigned int row_num, const char* filename)
 {
     printf("\033[1;33m");                   // change text color to yellow
     printf("Warning: value");
     printf("\033[1;31m");                   // change text color to red
     printf(" %d ", value);
     printf("\033[1;33m");                   // change text color to yellow
-    printf("found on row %d\n", row_num);
+    printf("found on row %d in '%s'\n", row_num, filename);
     printf("\033[0m");                      // reset text color
 }
 
@@ -178,22 +274,28 @@ void report_error(const char* message, bool exit_program)
 }
 
 
-int calculate_matrix_sum(const char* filepath, unsigned int n)
+int calculate_matrix_sum(const char* filepath, unsigned int n, int fd)
 {
+    record_batch batch;                 // records not sent yet
+    batch.fd = fd;
+    batch.count = 0;
+
     FILE* file;                         // the input file
     file = fopen(filepath, "r");        // try open the given file
 
     if (file == NULL)
     {
-        report_error("Range: cannot open file", false);
+        send_record(&batch, REC_ERROR, 0, 0);
+        flush_records(&batch);
         return -1;
     }
 
-    unsigned int    result  = 0;        // the sum to be calculated
+    uint64_t        result  = 0;        // the sum to be calculated
     unsigned int    count   = 0;        // count the no. of numbers on a line
     unsigned int    row     = 1;        // current row/line
     int             num;                // contains the current number read
     char            ch      = 0;        // contains the char read
+    char            last    = '\n';     // the last char before EOF
     bool         ignore     = false;    // ignore the number read if true
 
     while (ch != EOF)
@@ -206,56 +308,173 @@ int calculate_matrix_sum(const char* filepath, unsigned int n)
 
             if (!ignore)                // skip if ignore is set
             {
-                if (num < 0) print_warning(num, row);
+                if (num < 0) send_record(&batch, REC_WARNING, row, num);
                 else result += num;
             }
             // if there are more nums on the line than input N,
             // ignore the remaining nums on that line
             if (++count >= n) ignore = true;
         }
+        if (ch != 0) last = ch;
         ch = getc(file);
         if (ch == '\n')                 // if newline detected
         {
             row++;                      // increase the row number
             count = 0;                  // reset the numbers counted
             ignore = false;             // reset ignore flag
+
+            // report the progress, one write every PARTIAL_ROWS rows
+            if ((row - 1) % PARTIAL_ROWS == 0)
+            {
+                send_record(&batch, REC_PARTIAL, row - 1, result);
+                flush_records(&batch);
+            }
         }
     }
     fclose(file);                       // close the file
-    return result;                      // return the result calculated
+    // a last line without a newline still counts as a row
+    send_record(&batch, REC_DONE, (last == '\n') ? row - 1 : row, result);
+    flush_records(&batch);
+    return 0;
+}
+
+
+void send_record(record_batch* batch, record_type type, uint32_t row,
+                 int64_t value)
+{
+    record* rec = &batch->records[batch->count++];
+    rec->type = type;
+    rec->row = row;
+    rec->value = value;
+    if (batch->count == BATCH_RECORDS) flush_records(batch);
 }
 
 
-void process_matrices_parallel(unsigned int i, int fd[][2], unsigned int argc,
-                               char** args, unsigned int n)
+void flush_records(record_batch* batch)
 {
-    if (i == 0) 
+    const char* data = (const char*)batch->records;
+    size_t left = batch->count * sizeof(record);
+
+    while (left > 0)
     {
-        printf("returning\n");
-        return;
+        ssize_t written = write(batch->fd, data, left);
+        if (written < 0)
+        {
+            if (errno == EINTR) continue;
+            break;                      // the parent is gone
+        }
+        data += written;
+        left -= written;
     }
-    int pid = fork();
+    batch->count = 0;
+}
 
-    // if fork failed
-    if (pid < 0) report_error("Fork Failed", true);
-    // child process
-    if (pid == 0)
+
+void spawn_children(child_state* children, unsigned int count, unsigned int n)
+{
+    for (unsigned int i = 0; i < count; i++)
     {
-        printf("child\n");
-        //make recursion to process all the input files in parallel
-        printf("Processing %s...\n", args[i]);
-        process_matrices_parallel(i - 1, fd, argc, args, n);
-        unsigned int sum = calculate_matrix_sum(args[i], n);
-
-        //Use the pipe to transfer the array
-        write(fd[i - 1][1], &sum, sizeof(sum));
-        exit(0);
+        int fd[2];
+        if (pipe(fd) < 0) report_error("Pipe Failed", true);
+
+        fflush(stdout);                 // do not let the child repeat output
+        int pid = fork();
+
+        // if fork failed
+        if (pid < 0) report_error("Fork Failed", true);
+        // child process: sum the file, stream the records and leave
+        if (pid == 0)
+        {
+            close(fd[0]);
+            for (unsigned int j = 0; j < i; j++) close(children[j].fd);
+            int ret = calculate_matrix_sum(children[i].filepath, n, fd[1]);
+            close(fd[1]);
+            exit(ret == 0 ? 0 : 1);
+        }
+        // parent process: keep the read end only
+        close(fd[1]);
+        children[i].fd = fd[0];
+        printf("Processing %s...\n", children[i].filepath);
     }
-    // parent process
-    else
+}
+
+
+void collect_records(child_state* children, unsigned int count)
+{
+    struct pollfd fds[count];
+    unsigned int open_pipes = count;
+    record buffer[BATCH_RECORDS];
+
+    for (unsigned int i = 0; i < count; i++)
     {
-        printf("parent\n");
-        close(fd[n - 1][1]);
-        wait(NULL);
+        fds[i].fd = children[i].fd;
+        fds[i].events = POLLIN;
     }
-}
\ No newline at end of file
+
+    while (open_pipes > 0)
+    {
+        if (poll(fds, count, -1) < 0)
+        {
+            if (errno == EINTR) continue;
+            report_error("Poll Failed", true);
+        }
+        for (unsigned int i = 0; i < count; i++)
+        {
+            if (fds[i].fd < 0 || fds[i].revents == 0) continue;
+
+            child_state* child = &children[i];
+            char* data = (char*)buffer;
+            size_t have = 0;
+
+            // finish the record cut short by the last read first
+            if (child->pending > 0)
+            {
+                memcpy(data, &child->partial, child->pending);
+                have = child->pending;
+            }
+            ssize_t got = read(fds[i].fd, data + have, sizeof(buffer) - have);
+            if (got <= 0)
+            {
+                if (got < 0 && errno == EINTR) continue;
+                close(fds[i].fd);
+                fds[i].fd = -1;         // poll skips negative descriptors
+                open_pipes--;
+                continue;
+            }
+            have += got;
+
+            size_t whole = have / sizeof(record);
+            for (size_t r = 0; r < whole; r++) handle_record(child, &buffer[r]);
+            child->pending = have - whole * sizeof(record);
+            memcpy(&child->partial, data + whole * sizeof(record), child->pending);
+        }
+    }
+}
+
+
+void handle_record(child_state* child, const record* rec)
+{
+    switch (rec->type)
+    {
+    case REC_WARNING:
+        print_warning((int)rec->value, rec->row, child->filepath);
+        break;
+    case REC_PARTIAL:
+        child->rows = rec->row;
+        child->sum = rec->value;
+        printf("%s: %u rows, partial sum %" PRIu64 "\n",
+               child->filepath, child->rows, child->sum);
+        break;
+    case REC_DONE:
+        child->rows = rec->row;
+        child->sum = rec->value;
+        child->done = true;
+        printf("%s: done, %u rows, sum %" PRIu64 "\n",
+               child->filepath, child->rows, child->sum);
+        break;
+    case REC_ERROR:
+        child->failed = true;
+        report_error("Range: cannot open file\n", false);
+        break;
+    }
+}
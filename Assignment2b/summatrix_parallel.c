@@ -15,9 +15,15 @@
 #include <stdlib.h>
 #include <sys/wait.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
 
-#define INT_SIZE sizeof(int)
+#define CHUNK_FLAG  "-c"            // flag to split each file across all cores
+#define POOL_FLAG   "-p"            // flag to fan files out to a worker pool
+#define CACHE_LINE  64              // size of a cache line in bytes
 
 
 /**
@@ -31,6 +37,49 @@ typedef enum
 BOOLEAN;
 
 
+/**
+ * @brief the results of one worker process. each slot owns whole cache
+ *        lines, so workers never write to a line another worker uses
+ */
+typedef struct
+{
+    uint64_t        sum;            // sum of the files processed
+    uint64_t        bytes;          // no. of bytes processed
+    uint64_t        rows;           // no. of rows processed
+    uint64_t        nsecs;          // time spent processing, in nanoseconds
+}
+__attribute__((aligned(CACHE_LINE)))
+WORKER_SLOT;
+
+
+/**
+ * @brief the layout of the memory shared by all the processes: a small
+ *        header, then one result slot per worker
+ */
+typedef struct
+{
+    int             next_file;      // index of the next file to be claimed
+    int             num_slots;      // no. of worker slots
+    WORKER_SLOT     slots[];        // the result slots, one per worker
+}
+SHARED_REGION;
+
+
+/**
+ * @brief a byte range of a file, aligned to whole lines, that is summed
+ *        by its own worker process
+ */
+typedef struct
+{
+    size_t          begin;          // offset of the first byte in the range
+    size_t          end;            // offset right after the last byte
+    unsigned int    rows;           // no. of newlines inside the range
+    unsigned int    first_row;      // row number of the first line in range
+    uint64_t        sum;            // the sum calculated over the range
+}
+CHUNK;
+
+
 /*===========================================================================*/
 /* Globals                                                                   */
 /*===========================================================================*/
@@ -38,7 +87,10 @@ BOOLEAN;
 int     argc;               // no. of input arguments
 char**  argv;               // input arguments vector
 int     n;                  // number of columns in matrix to process
-int*    shared_mem;         // the shared memory
+SHARED_REGION* shared_mem; // the shared memory
+size_t  shared_size;        // size of the shared memory
+BOOLEAN chunked = FALSE;    // split each file into ranges across all cores
+BOOLEAN pooled  = FALSE;    // let a pool of workers claim the files
 
 
 /*===========================================================================*/
@@ -57,7 +109,26 @@ void report_error(const char* message);
 
 int process_file(int depth);
 
-int calculate_matrix_sum(const char* filepath, unsigned int n);
+int process_files_pool(int num_of_files);
+
+int run_pool_worker(int worker, int num_of_files);
+
+int calculate_matrix_sum(const char* filepath, unsigned int n,
+                         WORKER_SLOT* slot);
+
+uint64_t reduce_slots(int num_slots);
+
+size_t align_to_line(const char* data, size_t size, size_t offset);
+
+unsigned int count_rows(const char* data, const CHUNK* chunk);
+
+uint64_t calculate_range_sum(const char* data, const CHUNK* chunk,
+                             unsigned int n, const char* filepath);
+
+int run_chunk_workers(const char* data, CHUNK* chunks, int num_chunks,
+                      BOOLEAN count_only, const char* filepath);
+
+int calculate_matrix_sum_chunked(const char* filepath, uint64_t* sum);
 
 
 /*===========================================================================*/
@@ -66,6 +137,17 @@ int calculate_matrix_sum(const char* filepath, unsigned int n);
 
 int main(int arg_c, char** arg_v)
 {
+    // check for the optional flags and drop them from the arguments
+    while (arg_c > 1 && (strcmp(arg_v[1], CHUNK_FLAG) == 0 ||
+                         strcmp(arg_v[1], POOL_FLAG) == 0))
+    {
+        if (strcmp(arg_v[1], CHUNK_FLAG) == 0) chunked = TRUE;
+        else pooled = TRUE;
+        arg_v[1] = arg_v[0];
+        arg_v++;
+        arg_c--;
+    }
+
     // check if the command line input is valid
     if (validate_input(arg_c, arg_v) == FALSE) return 1;
 
@@ -74,9 +156,38 @@ int main(int arg_c, char** arg_v)
 
     int num_of_files = argc - 2;
 
-    if (process_file(num_of_files) == -1) return -1;
+    if (chunked == TRUE)
+    {
+        // one file at a time, each one spread over all the cores
+        uint64_t total = 0;
+        for (int i = 1; i <= num_of_files; i++)
+        {
+            printf("\nProcessing '%s'...\n", argv[i]);
+            if (calculate_matrix_sum_chunked(argv[i], &total) == -1)
+            {
+                return -1;
+            }
+        }
+        printf("\n\nThe matrix sum is: %" PRIu64 "\n", total);
+        return 0;
+    }
 
-    printf("\n\nThe matrix sum is: %d\n", *shared_mem);
+    if (shared_mem == MAP_FAILED)
+    {
+        report_error("Map Failed");
+        return -1;
+    }
+
+    // the chain uses one worker per file, the pool one per core at most
+    int num_workers = num_of_files;
+    if (pooled == TRUE)
+    {
+        num_workers = process_files_pool(num_of_files);
+        if (num_workers == -1) return -1;
+    }
+    else if (process_file(num_of_files) == -1) return -1;
+
+    printf("\n\nThe matrix sum is: %" PRIu64 "\n", reduce_slots(num_workers));
 
     return 0;
 }
@@ -91,13 +202,21 @@ void init_globs(int arg_c, char** arg_v)
     n           = (int) strtol(arg_v[arg_c - 1], (char**)NULL, 10);
     argc        = arg_c;
     argv        = arg_v;
-    shared_mem  = (int*)mmap(
+
+    // enough slots for a chain of one worker per file, or a pool of
+    // one worker per core
+    long num_slots = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_slots < arg_c - 2) num_slots = arg_c - 2;
+
+    shared_size = sizeof(SHARED_REGION) + num_slots * sizeof(WORKER_SLOT);
+    shared_mem  = (SHARED_REGION*)mmap(
                         NULL,
-                        (int) n * INT_SIZE,
+                        shared_size,
                         PROT_READ|PROT_WRITE,
                         MAP_ANON|MAP_SHARED,
                         -1, 
                         0);
+    if (shared_mem != MAP_FAILED) shared_mem->num_slots = num_slots;
 }
 
 
@@ -186,7 +305,8 @@ void report_error(const char* message)
 /* calculate_matrix_sum         Calculate the matrix sum in a given file     */
 /*===========================================================================*/
 
-int calculate_matrix_sum(const char* filepath, unsigned int n)
+int calculate_matrix_sum(const char* filepath, unsigned int n,
+                         WORKER_SLOT* slot)
 {
     FILE* file;                         // the input file
     file = fopen(filepath, "r");        // try open the given file
@@ -197,11 +317,15 @@ int calculate_matrix_sum(const char* filepath, unsigned int n)
         return -1;
     }
 
-    unsigned int    result  = 0;        // the sum to be calculated
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    uint64_t        result  = 0;        // the sum to be calculated
     unsigned int    count   = 0;        // count the no. of numbers on a line
     unsigned int    row     = 1;        // current row/line
     int             num;                // contains the current number read
     char            ch      = 0;        // contains the char read
+    char            last    = '\n';     // the last char before EOF
     BOOLEAN         ignore  = FALSE;    // ignore the number read if true
 
     while (ch != EOF)
@@ -221,6 +345,7 @@ int calculate_matrix_sum(const char* filepath, unsigned int n)
             // ignore the remaining nums on that line
             if (++count >= n) ignore = TRUE;
         }
+        if (ch != 0) last = ch;
         ch = getc(file);
         if (ch == '\n')                 // if newline detected
         {
@@ -229,8 +354,44 @@ int calculate_matrix_sum(const char* filepath, unsigned int n)
             ignore = FALSE;             // reset ignore flag
         }
     }
+
+    // a last line without a newline still counts as a row
+    slot->rows  += (last == '\n') ? row - 1 : row;
+    slot->bytes += ftell(file);
+    slot->sum   += result;
     fclose(file);                       // close the file
-    return result;                      // return the result calculated
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    slot->nsecs += (end.tv_sec - start.tv_sec) * 1000000000ULL
+                   + end.tv_nsec - start.tv_nsec;
+    return 0;
+}
+
+
+/*===========================================================================*/
+/* reduce_slots                 Add up the results of the workers and print  */
+/*                              the throughput of each one                   */
+/*===========================================================================*/
+
+uint64_t reduce_slots(int num_slots)
+{
+    uint64_t total = 0;
+
+    printf("\n");
+    for (int i = 0; i < num_slots; i++)
+    {
+        WORKER_SLOT* slot = &shared_mem->slots[i];
+        double secs = slot->nsecs / 1000000000.0;
+        total += slot->sum;
+        printf("Worker #%d: %" PRIu64 " rows, %" PRIu64 " bytes in %.6fs"
+               " (%.1f MB/s)\n",
+               i,
+               slot->rows,
+               slot->bytes,
+               secs,
+               secs > 0 ? slot->bytes / secs / 1e6 : 0.0);
+    }
+    return total;
 }
 
 
@@ -242,15 +403,7 @@ int process_file(int depth)
 {
     if (depth == 0) return 0;
 
-    int sum = 0;
     int pid = fork();
-    
-    // if map failed
-    if (shared_mem == MAP_FAILED)
-    {
-        report_error("Map Failed");
-        return -1;
-    }
 
     // if fork failed
     if (pid < 0)
@@ -265,8 +418,11 @@ int process_file(int depth)
         if (process_file(depth - 1) == -1) return -1;
 
         printf("\nProcessing '%s'...\n", argv[depth]);
-        sum = calculate_matrix_sum(argv[depth], n);
-        *shared_mem += sum;
+        if (calculate_matrix_sum(argv[depth], n,
+                                 &shared_mem->slots[depth - 1]) == -1)
+        {
+            exit(1);
+        }
 
         exit(0);
     }
@@ -274,8 +430,308 @@ int process_file(int depth)
     // if parent process
     else
     {
-        wait(NULL);
+        int status;
+        wait(&status);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) return -1;
+    }
+
+    return 0;
+}
+
+
+/*===========================================================================*/
+/* process_files_pool           Fork a flat pool of workers that claim the   */
+/*                              files from the shared memory, then reap them */
+/*                              and return the no. of workers started        */
+/*===========================================================================*/
+
+int process_files_pool(int num_of_files)
+{
+    // one worker per core, but never more workers than files
+    long num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_workers < 1) num_workers = 1;
+    if (num_workers > num_of_files) num_workers = num_of_files;
+
+    shared_mem->next_file = 0;
+    fflush(stdout);                     // do not let children repeat output
+
+    int failed = 0;
+    int started = 0;
+    for (long i = 0; i < num_workers; i++)
+    {
+        int pid = fork();
+
+        // if fork failed, the workers already running still drain the queue
+        if (pid < 0)
+        {
+            report_error("Forked Failed");
+            failed = (i == 0);
+            break;
+        }
+        started++;
+
+        // if child process, work until no file is left
+        if (pid == 0)
+        {
+            setvbuf(stdout, NULL, _IOLBF, 0);
+            int ret = run_pool_worker(i, num_of_files);
+            fflush(stdout);
+            _exit(ret == -1 ? 1 : 0);
+        }
     }
 
-    return *shared_mem;
-}
\ No newline at end of file
+    // if parent process, reap every worker in a single loop
+    int status;
+    while (wait(&status) > 0)
+    {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed = 1;
+    }
+    return failed ? -1 : started;
+}
+
+
+/*===========================================================================*/
+/* run_pool_worker              Claim files from the shared memory and sum   */
+/*                              them until none is left                      */
+/*===========================================================================*/
+
+int run_pool_worker(int worker, int num_of_files)
+{
+    int i;
+    int ret = 0;
+
+    while ((i = __atomic_fetch_add(&shared_mem->next_file, 1, __ATOMIC_RELAXED))
+           < num_of_files)
+    {
+        printf("\nProcessing '%s'...\n", argv[i + 1]);
+        if (calculate_matrix_sum(argv[i + 1], n,
+                                 &shared_mem->slots[worker]) == -1)
+        {
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+
+/*===========================================================================*/
+/* align_to_line                Move an offset to the start of the next line */
+/*===========================================================================*/
+
+size_t align_to_line(const char* data, size_t size, size_t offset)
+{
+    if (offset == 0) return 0;
+    if (offset >= size) return size;
+
+    // a range starts right after the newline at or before `offset`
+    const char* newline = memchr(data + offset - 1, '\n', size - offset + 1);
+    return newline == NULL ? size : (size_t)(newline - data) + 1;
+}
+
+
+/*===========================================================================*/
+/* count_rows                   Count the newlines in a range of the file    */
+/*===========================================================================*/
+
+unsigned int count_rows(const char* data, const CHUNK* chunk)
+{
+    unsigned int    rows    = 0;
+    const char*     pos     = data + chunk->begin;
+    const char*     end     = data + chunk->end;
+
+    while ((pos = memchr(pos, '\n', end - pos)) != NULL)
+    {
+        rows++;
+        pos++;
+    }
+    return rows;
+}
+
+
+/*===========================================================================*/
+/* calculate_range_sum          Calculate the matrix sum in a range of lines */
+/*===========================================================================*/
+
+uint64_t calculate_range_sum(const char* data, const CHUNK* chunk,
+                             unsigned int n, const char* filepath)
+{
+    const char*     pos     = data + chunk->begin;
+    const char*     end     = data + chunk->end;
+    uint64_t        result  = 0;                // the sum to be calculated
+    unsigned int    count   = 0;                // no. of numbers on a line
+    unsigned int    row     = chunk->first_row; // current row/line
+
+    while (pos < end)
+    {
+        if (*pos == '\n')               // if newline detected
+        {
+            row++;                      // increase the row number
+            count = 0;                  // reset the numbers counted
+            pos++;
+            continue;
+        }
+        // a lone '-' or any other character is just skipped
+        BOOLEAN negative = (*pos == '-') ? TRUE : FALSE;
+        const char* digits = (negative == TRUE) ? pos + 1 : pos;
+        if (digits >= end || !isdigit(*digits))
+        {
+            pos++;
+            continue;
+        }
+
+        unsigned int value = 0;
+        while (digits < end && isdigit(*digits))
+        {
+            value = value * 10 + (*digits - '0');
+            digits++;
+        }
+        int num = (negative == TRUE) ? (int)(0u - value) : (int)value;
+        pos = digits;
+
+        // the first n numbers on a line are taken (at least one, like
+        // the stdio path), the rest of the line is ignored
+        if (count == 0 || count < n)
+        {
+            if (num < 0) print_warning(num, row, filepath);
+            else result += num;
+        }
+        count++;
+    }
+    return result;
+}
+
+
+/*===========================================================================*/
+/* run_chunk_workers            Fork one worker per chunk and wait for all   */
+/*===========================================================================*/
+
+int run_chunk_workers(const char* data, CHUNK* chunks, int num_chunks,
+                      BOOLEAN count_only, const char* filepath)
+{
+    fflush(stdout);                     // do not let children repeat output
+    for (int i = 0; i < num_chunks; i++)
+    {
+        int pid = fork();
+
+        // if fork failed
+        if (pid < 0)
+        {
+            report_error("Forked Failed");
+            while (wait(NULL) > 0);
+            return -1;
+        }
+
+        // if child process, handle its chunk and leave
+        if (pid == 0)
+        {
+            // whole lines per write, so warnings of workers do not mix
+            setvbuf(stdout, NULL, _IOLBF, 0);
+            if (count_only == TRUE)
+            {
+                chunks[i].rows = count_rows(data, &chunks[i]);
+            }
+            else
+            {
+                chunks[i].sum = calculate_range_sum(data, &chunks[i], n,
+                                                    filepath);
+            }
+            fflush(stdout);
+            _exit(0);
+        }
+    }
+
+    // if parent process, reap all the workers, and fail if any of them
+    // did not finish its chunk
+    int status;
+    int failed = 0;
+    while (wait(&status) > 0)
+    {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed = 1;
+    }
+    if (failed)
+    {
+        report_error("Range: a worker failed");
+        return -1;
+    }
+    return 0;
+}
+
+
+/*===========================================================================*/
+/* calculate_matrix_sum_chunked Calculate the matrix sum of a file by        */
+/*                              splitting it into ranges across all cores    */
+/*===========================================================================*/
+
+int calculate_matrix_sum_chunked(const char* filepath, uint64_t* sum)
+{
+    int         fd  = open(filepath, O_RDONLY);
+    struct stat st;
+
+    if (fd == -1 || fstat(fd, &st) == -1)
+    {
+        if (fd != -1) close(fd);
+        report_error("Range: cannot open file");
+        return -1;
+    }
+    if (st.st_size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    size_t      size    = st.st_size;
+    const char* data    = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        report_error("Map Failed");
+        return -1;
+    }
+
+    // never more workers than bytes, never less than one
+    long num_chunks = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_chunks < 1) num_chunks = 1;
+    if ((size_t)num_chunks > size) num_chunks = size;
+
+    CHUNK* chunks = mmap(NULL,
+                         num_chunks * sizeof(CHUNK),
+                         PROT_READ|PROT_WRITE,
+                         MAP_ANON|MAP_SHARED,
+                         -1,
+                         0);
+    if (chunks == MAP_FAILED)
+    {
+        munmap((void*)data, size);
+        report_error("Map Failed");
+        return -1;
+    }
+
+    for (long i = 0; i < num_chunks; i++)
+    {
+        chunks[i].begin = align_to_line(data, size, size * i / num_chunks);
+        chunks[i].end   = align_to_line(data, size, size * (i + 1) / num_chunks);
+        chunks[i].rows  = 0;
+        chunks[i].sum   = 0;
+    }
+
+    // first pass: count the rows of every chunk, so that each chunk knows
+    // the global row number it starts at
+    int ret = run_chunk_workers(data, chunks, num_chunks, TRUE, filepath);
+    unsigned int row = 1;
+    for (long i = 0; i < num_chunks; i++)
+    {
+        chunks[i].first_row = row;
+        row += chunks[i].rows;
+    }
+
+    // second pass: sum the chunks and reduce their results
+    if (ret == 0)
+    {
+        ret = run_chunk_workers(data, chunks, num_chunks, FALSE, filepath);
+        for (long i = 0; i < num_chunks; i++) *sum += chunks[i].sum;
+    }
+
+    munmap(chunks, num_chunks * sizeof(CHUNK));
+    munmap((void*)data, size);
+    return ret;
+}
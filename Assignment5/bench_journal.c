@@ -0,0 +1,120 @@
+/******************************************************************************
+ *
+ * @file        bench_journal.c
+ *
+ * @author      Luan Truong
+ *
+ * @brief       A benchmark of the replay of the run journal of proc_manager: a
+ *              journal of launch, exit and done records is written for many
+ *              commands, then replayed into a table of command states, as
+ *              proc_manager does on startup.
+ *
+ * @version     0.1
+ *
+ * @date        April 2022
+ *
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "journal.h"
+
+#define DEFAULT_RECORDS     1000000
+#define JOURNAL_PATH        ".bench-journal.bin"
+#define PRECISION           1000000000.0
+
+/******************************************************************************
+ * @brief   What replay learns about a command.
+ *****************************************************************************/
+struct command_state {
+    unsigned            launches;   /* no. of runs launched */
+    unsigned            crashes;    /* no. of runs that did not exit with 0 */
+    int                 done;       /* whether it will not run again */
+};
+
+/******************************************************************************
+ * @brief   Replay a record into the state of its command.
+ *
+ * @param r         The record.
+ * @param arg       The states.
+ *****************************************************************************/
+void apply(const struct journal_record* r, void* arg)
+{
+    struct command_state* cs = (struct command_state*)arg + r->index;
+    switch (r->type) {
+    case JOURNAL_LAUNCH:
+        cs->launches = r->generation + 1;
+        break;
+    case JOURNAL_EXIT:
+        cs->crashes += r->status != 0;
+        break;
+    case JOURNAL_DONE:
+        cs->done = 1;
+        break;
+    }
+}
+
+                /*******************************************/
+                /*                                         */
+                /*                  M A I N                */
+                /*                                         */
+                /*******************************************/
+
+int main(int argc, char** argv)
+{
+    long                    records     = argc > 1 ? atol(argv[1]) : DEFAULT_RECORDS;
+    long                    ncommands   = records / 3 + 1;
+    struct command_state*   states      = calloc(ncommands, sizeof(*states));
+    uint32_t                hash        = journal_hash("sleep 1");
+    struct timespec         start_t;
+    struct timespec         end_t;
+    long                    replayed;
+    long                    done        = 0;
+
+    if (states == NULL) {
+        return EXIT_FAILURE;
+    }
+    unlink(JOURNAL_PATH);
+    if (journal_open(JOURNAL_PATH, 0, apply, states) != 0) {
+        perror("bench_journal");
+        return EXIT_FAILURE;
+    }
+    for (long i = 0; i < records; ++i) {
+        uint32_t index = i / 3;
+        switch (i % 3) {
+        case 0:
+            journal_append(JOURNAL_LAUNCH, index, hash, 0, 1000 + index, 0);
+            break;
+        case 1:
+            journal_append(JOURNAL_EXIT, index, hash, 0, 1000 + index, 0);
+            break;
+        default:
+            journal_append(JOURNAL_DONE, index, hash, 0, 1000 + index, 1);
+        }
+    }
+    journal_close();
+
+    clock_gettime(CLOCK_MONOTONIC, &start_t);
+    replayed = journal_open(JOURNAL_PATH, 0, apply, states);
+    clock_gettime(CLOCK_MONOTONIC, &end_t);
+    journal_close();
+    unlink(JOURNAL_PATH);
+
+    for (long i = 0; i < ncommands; ++i) {
+        done += states[i].done;
+    }
+    double elapsed = (end_t.tv_sec - start_t.tv_sec)
+                   + (end_t.tv_nsec - start_t.tv_nsec) / PRECISION;
+    printf(
+        "replayed %ld records (%ld bytes each, %ld commands done) in %.3fs\n",
+        replayed,
+        sizeof(struct journal_record),
+        done,
+        elapsed
+    );
+    free(states);
+    return replayed == records ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,273 @@
+/******************************************************************************
+ *
+ * @file        bench_launch.c
+ *
+ * @author      Luan Truong
+ *
+ * @brief       A benchmark of the launch latency of proc_manager: the time from
+ *              deciding to run a command until it is executing, for fork then
+ *              execvp (searching PATH every time), fork then execv of a path
+ *              resolved once, posix_spawnp, and a zygote forked ahead of time
+ *              that only has to execv. The launch is over when the exec has
+ *              closed a close-on-exec pipe held by the child. The zygote pool
+ *              is refilled after each launch, off the clock, and a zygote is
+ *              only used once it is waiting for its order.
+ *
+ * @version     0.1
+ *
+ * @date        April 2022
+ *
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define DEFAULT_LAUNCHES    2000
+#define COMMAND             "true"
+#define PRECISION           1000000000.0
+
+extern char** environ;
+
+/******************************************************************************
+ * @brief   The ways a command can be launched.
+ *****************************************************************************/
+enum method {
+    METHOD_EXECVP,              /* fork, then execvp */
+    METHOD_EXECV,               /* fork, then execv of the resolved path */
+    METHOD_SPAWN,               /* posix_spawnp */
+    METHOD_ZYGOTE,              /* a zygote forked ahead, then execv */
+    METHOD_COUNT
+};
+
+static const char* method_names[] = {
+    "fork+execvp", "fork+execv", "posix_spawnp", "zygote+execv"
+};
+
+/******************************************************************************
+ * @brief   A zygote waiting for its order.
+ *****************************************************************************/
+struct zygote {
+    int                 pid;        /* its process ID */
+    int                 ctl;        /* the pipe its order is written to */
+    int                 done;       /* the pipe closed by its exec */
+};
+
+/******************************************************************************
+ * @brief   Look for an executable in the directories of PATH.
+ *
+ * @param name      The name of the executable.
+ * @param path      Where to store its path.
+ * @param size      The size of path.
+ *
+ * @return  0 if it was found, -1 otherwise.
+ *****************************************************************************/
+int search_path(const char* name, char* path, size_t size)
+{
+    const char* dirs = getenv("PATH");
+    struct stat st;
+    while (dirs && *dirs) {
+        size_t len = strcspn(dirs, ":");
+        snprintf(path, size, "%.*s/%s", (int)len, dirs, name);
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0) {
+            return 0;
+        }
+        dirs += len + (dirs[len] == ':');
+    }
+    return -1;
+}
+
+/******************************************************************************
+ * @brief   Create a pipe whose write end is closed by a successful exec.
+ *
+ * @param fds       Where to store its ends.
+ *
+ * @return  0 on success, -1 otherwise.
+ *****************************************************************************/
+int exec_pipe(int fds[2])
+{
+    if (pipe(fds) == -1) {
+        return -1;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return 0;
+}
+
+/******************************************************************************
+ * @brief   Fork a zygote, that executes the command once told to, and wait
+ *          until it is ready.
+ *
+ * @param path      The resolved path of the command.
+ * @param arglist   Its arguments.
+ * @param z         Where to store the zygote.
+ *
+ * @return  0 on success, -1 otherwise.
+ *****************************************************************************/
+int fork_zygote(const char* path, char** arglist, struct zygote* z)
+{
+    int ctl[2];
+    int done[2];
+    if (exec_pipe(ctl) == -1) {
+        return -1;
+    }
+    if (exec_pipe(done) == -1) {
+        close(ctl[0]);
+        close(ctl[1]);
+        return -1;
+    }
+    if ((z->pid = fork()) == 0) {
+        char order;
+        close(ctl[1]);
+        close(done[0]);
+        write(done[1], "", 1);
+        if (read(ctl[0], &order, 1) == 1) {
+            execv(path, arglist);
+        }
+        _exit(EXIT_FAILURE);
+    }
+    char ready;
+    close(ctl[0]);
+    close(done[1]);
+    z->ctl  = ctl[1];
+    z->done = done[0];
+    return z->pid < 0 || read(z->done, &ready, 1) != 1 ? -1 : 0;
+}
+
+/******************************************************************************
+ * @brief   The comparison of two latencies for qsort.
+ *****************************************************************************/
+int compare_latencies(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/******************************************************************************
+ * @brief   Launch the command a number of times with the given method,
+ *          waiting for each child before the next one.
+ *
+ * @param method        How to launch it.
+ * @param path          The resolved path of the command.
+ * @param launches      The number of launches.
+ * @param latencies     Where to store the latency of each launch, sorted.
+ *
+ * @return  0 on success, -1 otherwise.
+ *****************************************************************************/
+int run(enum method method, const char* path, int launches, double* latencies)
+{
+    char*           arglist[] = { COMMAND, NULL };
+    struct timespec start_t;
+    struct timespec end_t;
+    struct zygote   z;
+    int             fds[2];
+    int             pid;
+    char            byte;
+
+    if (method == METHOD_ZYGOTE && fork_zygote(path, arglist, &z) == -1) {
+        return -1;
+    }
+    for (int i = 0; i < launches; ++i) {
+        if (method != METHOD_ZYGOTE && exec_pipe(fds) == -1) {
+            return -1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start_t);
+        switch (method) {
+        case METHOD_EXECVP:
+        case METHOD_EXECV:
+            if ((pid = fork()) == 0) {
+                if (method == METHOD_EXECV) {
+                    execv(path, arglist);
+                }
+                execvp(arglist[0], arglist);
+                _exit(EXIT_FAILURE);
+            }
+            break;
+        case METHOD_SPAWN:
+            if (posix_spawnp(&pid, arglist[0], NULL, NULL, arglist, environ)) {
+                pid = -1;
+            }
+            break;
+        default:
+            pid     = z.pid;
+            fds[0]  = z.done;
+            write(z.ctl, "", 1);
+            close(z.ctl);
+        }
+        if (method != METHOD_ZYGOTE) {
+            close(fds[1]);
+        }
+        while (read(fds[0], &byte, 1) > 0);     // until the exec
+        clock_gettime(CLOCK_MONOTONIC, &end_t);
+        close(fds[0]);
+
+        latencies[i] = (end_t.tv_sec - start_t.tv_sec)
+                     + (end_t.tv_nsec - start_t.tv_nsec) / PRECISION;
+        if (method == METHOD_ZYGOTE && i + 1 < launches
+            && fork_zygote(path, arglist, &z) == -1) {
+            return -1;
+        }
+        if (pid > 0) {
+            waitpid(pid, NULL, 0);
+        }
+    }
+    qsort(latencies, launches, sizeof(*latencies), compare_latencies);
+    return 0;
+}
+
+                /*******************************************/
+                /*                                         */
+                /*                  M A I N                */
+                /*                                         */
+                /*******************************************/
+
+int main(int argc, char** argv)
+{
+    int     launches    = argc > 1 ? atoi(argv[1]) : DEFAULT_LAUNCHES;
+    size_t  sizes[]     = { 0, 256 };               // Parent sizes in MB.
+    double* latencies   = malloc(launches * sizeof(*latencies));
+    char    path[4096];
+
+    if (launches <= 0 || latencies == NULL) {
+        return EXIT_FAILURE;
+    }
+    if (search_path(COMMAND, path, sizeof(path)) == -1) {
+        fprintf(stderr, "`%s` is not in PATH\n", COMMAND);
+        return EXIT_FAILURE;
+    }
+    printf("%d launches of `%s` per run, latency until exec\n\n", launches, path);
+    printf("%10s %14s %12s %12s\n", "parent MB", "method", "p50 us", "p99 us");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); ++i) {
+        size_t  bytes   = sizes[i] << 20;
+        char*   ballast = bytes ? malloc(bytes) : NULL;
+        if (bytes && ballast == NULL) {
+            break;
+        }
+        if (ballast) {
+            memset(ballast, 1, bytes);              // Fault every page in.
+        }
+        for (int m = 0; m < METHOD_COUNT; ++m) {
+            if (run(m, path, launches, latencies) == -1) {
+                perror("bench_launch");
+                continue;
+            }
+            printf(
+                "%10lu %14s %12.1f %12.1f\n",
+                sizes[i],
+                method_names[m],
+                latencies[launches / 2] * 1e6,
+                latencies[launches * 99 / 100] * 1e6
+            );
+        }
+        free(ballast);
+    }
+    free(latencies);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,97 @@
+/******************************************************************************
+ *
+ * @file        bench_spawn.c
+ *
+ * @author      Luan Truong
+ *
+ * @brief       A benchmark of the launch backends of proc_manager: fork then
+ *              execvp, against posix_spawnp. The parent touches a large buffer
+ *              first, since the page tables fork has to copy grow with it.
+ *
+ * @version     0.1
+ *
+ * @date        April 2022
+ *
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+#define DEFAULT_LAUNCHES    2000
+#define PRECISION           1000000000.0
+
+extern char** environ;
+
+/******************************************************************************
+ * @brief   Launch `true` a number of times with the given backend, waiting for
+ *          each child before the next one.
+ *
+ * @param spawn         Whether to use posix_spawnp instead of fork.
+ * @param launches      The number of children to launch.
+ *
+ * @return  The number of launches per second.
+ *****************************************************************************/
+double run(int spawn, int launches)
+{
+    char*           arglist[] = { "true", NULL };
+    struct timespec start_t;
+    struct timespec end_t;
+    int             pid;
+
+    clock_gettime(CLOCK_MONOTONIC, &start_t);
+    for (int i = 0; i < launches; ++i) {
+        if (spawn) {
+            if (posix_spawnp(&pid, arglist[0], NULL, NULL, arglist, environ)) {
+                return 0;
+            }
+        }
+        else if ((pid = fork()) == 0) {
+            execvp(arglist[0], arglist);
+            _exit(EXIT_FAILURE);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end_t);
+
+    double elapsed = (end_t.tv_sec - start_t.tv_sec)
+                   + (end_t.tv_nsec - start_t.tv_nsec) / PRECISION;
+    return launches / elapsed;
+}
+
+                /*******************************************/
+                /*                                         */
+                /*                  M A I N                */
+                /*                                         */
+                /*******************************************/
+
+int main(int argc, char** argv)
+{
+    int     launches = argc > 1 ? atoi(argv[1]) : DEFAULT_LAUNCHES;
+    size_t  sizes[]  = { 0, 64, 256, 1024 };        // Parent sizes in MB.
+
+    printf("%d launches of `true` per run\n\n", launches);
+    printf("%10s %16s %16s\n", "parent MB", "fork/s", "posix_spawn/s");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); ++i) {
+        size_t  bytes   = sizes[i] << 20;
+        char*   ballast = bytes ? malloc(bytes) : NULL;
+        if (bytes && ballast == NULL) {
+            break;
+        }
+        if (ballast) {
+            memset(ballast, 1, bytes);              // Fault every page in.
+        }
+        printf(
+            "%10lu %16.0f %16.0f\n",
+            sizes[i],
+            run(0, launches),
+            run(1, launches)
+        );
+        free(ballast);
+    }
+    return EXIT_SUCCESS;
+}
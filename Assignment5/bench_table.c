@@ -0,0 +1,178 @@
+/******************************************************************************
+ *
+ * @file        bench_table.c
+ *
+ * @author      Luan Truong
+ *
+ * @brief       A benchmark of the pid table of proc_manager under churn: a
+ *              window of live pids slides forward, inserting a new pid,
+ *              looking up a live one and removing the oldest at every step.
+ *              The 101 bucket chained table proc_manager used before, which
+ *              allocated a node and a copy of the command on every insert, is
+ *              run the same way for comparison.
+ *
+ * @version     0.1
+ *
+ * @date        April 2022
+ *
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "pid_table.h"
+
+#define STEPS           500000
+#define HASHSIZE        101
+#define PRECISION       1000000000.0
+#define COMMAND         "sleep 1"
+
+                /*******************************************/
+                /*                                         */
+                /*           Chained Table (old)           */
+                /*                                         */
+                /*******************************************/
+
+/******************************************************************************
+ * @brief   A node of the chained table.
+ *****************************************************************************/
+struct cnode {
+    struct cnode*       next;       /* next entry in chain */
+    int                 pid;        /* the process ID */
+    char*               command;    /* the command stored */
+};
+
+static struct cnode*    chaintab[HASHSIZE];     /* Pointer table. */
+
+/******************************************************************************
+ * @brief   Look for the given pid in the chained table.
+ *
+ * @param pid       The pid to look for.
+ *
+ * @return  The node with the given pid, or NULL.
+ *****************************************************************************/
+struct cnode* chain_lookup(int pid)
+{
+    struct cnode* np = chaintab[pid % HASHSIZE];
+    while (np && np->pid != pid) {
+        np = np->next;
+    }
+    return np;
+}
+
+/******************************************************************************
+ * @brief   Insert a pid and a copy of its command into the chained table.
+ *
+ * @param pid       The process ID.
+ * @param command   The command.
+ *****************************************************************************/
+void chain_insert(int pid, const char* command)
+{
+    struct cnode* np    = malloc(sizeof(*np));
+    np->pid             = pid;
+    np->command         = strdup(command);
+    np->next            = chaintab[pid % HASHSIZE];
+    chaintab[pid % HASHSIZE] = np;
+}
+
+/******************************************************************************
+ * @brief   Remove a pid from the chained table.
+ *
+ * @param pid       The process ID.
+ *****************************************************************************/
+void chain_remove(int pid)
+{
+    struct cnode** link = &chaintab[pid % HASHSIZE];
+    while (*link && (*link)->pid != pid) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        struct cnode* np = *link;
+        *link = np->next;
+        free(np->command);
+        free(np);
+    }
+}
+
+                /*******************************************/
+                /*                                         */
+                /*                Benchmark                */
+                /*                                         */
+                /*******************************************/
+
+/******************************************************************************
+ * @brief   Slide a window of live pids forward.
+ *
+ * @param chained       Whether to run the old chained table.
+ * @param live          The number of pids alive at once.
+ *
+ * @return  The number of steps per second.
+ *****************************************************************************/
+double run(int chained, int live)
+{
+    const char*     command = arena_strdup(COMMAND);
+    struct timespec start_t;
+    struct timespec end_t;
+    struct timespec now     = { 0, 0 };
+    long            found   = 0;
+
+    for (int pid = 1; pid <= live; ++pid) {
+        if (chained) {
+            chain_insert(pid, command);
+        }
+        else {
+            insert(pid, command, pid, now);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start_t);
+    for (int pid = live + 1; pid <= live + STEPS; ++pid) {
+        int probe = pid - 1 - (int)((pid * 7919L) % live);  // a live pid
+        if (chained) {
+            chain_insert(pid, command);
+            found += chain_lookup(probe) != NULL;
+            chain_remove(pid - live);
+        }
+        else {
+            insert(pid, command, pid, now);
+            found += lookup(probe) != NULL;
+            remove_pid(pid - live);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end_t);
+
+    for (int pid = STEPS + 1; pid <= STEPS + live; ++pid) {
+        chain_remove(pid);
+    }
+    free_htable();
+    if (found != STEPS) {
+        printf("lookup missed %ld live pids\n", STEPS - found);
+    }
+    double elapsed = (end_t.tv_sec - start_t.tv_sec)
+                   + (end_t.tv_nsec - start_t.tv_nsec) / PRECISION;
+    return STEPS / elapsed;
+}
+
+                /*******************************************/
+                /*                                         */
+                /*                  M A I N                */
+                /*                                         */
+                /*******************************************/
+
+int main()
+{
+    int lives[] = { 100, 1000, 10000, 20000 };     // Pids alive at once.
+
+    printf("%d steps of insert + lookup + remove per run\n\n", STEPS);
+    printf("%10s %16s %16s\n", "live pids", "chained Mstep/s", "open Mstep/s");
+    for (size_t i = 0; i < sizeof(lives) / sizeof(*lives); ++i) {
+        printf(
+            "%10d %16.2f %16.2f\n",
+            lives[i],
+            run(1, lives[i]) / 1e6,
+            run(0, lives[i]) / 1e6
+        );
+    }
+    return EXIT_SUCCESS;
+}
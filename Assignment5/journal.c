@@ -0,0 +1,255 @@
+/******************************************************************************
+ *
+ * @file        journal.c
+ *
+ * @author      Luan Truong
+ *
+ * @brief       The run journal of proc_manager. Records are appended to a
+ *              buffer, written with one write per turn of the event loop, and
+ *              synced to disk with fdatasync at most every sync_ms, so that a
+ *              burst of launches and exits shares a single sync. Each record
+ *              ends with a hash of its bytes, so a record half written by a
+ *              crash is found and dropped on replay. Replay reads the file
+ *              in large blocks, with no call per record but apply.
+ *
+ * @version     0.1
+ *
+ * @date        April 2022
+ *
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "journal.h"
+
+#define JOURNAL_BUF         4096        /* Records buffered at most. */
+#define REPLAY_BLOCK        65536       /* Records read at once on replay. */
+
+static int                      journal_fd      = -1;   /* The file. */
+static struct journal_record*   pending         = NULL; /* Not written yet. */
+static size_t                   pending_count   = 0;    /* No. of them. */
+static bool                     unsynced        = false;    /* Not synced. */
+static uint64_t                 sync_interval   = 0;    /* Between syncs, ns. */
+static uint64_t                 last_sync       = 0;    /* When, ns. */
+
+/******************************************************************************
+ * @brief   The time of a clock, in nanoseconds.
+ *
+ * @param clock     The clock.
+ *****************************************************************************/
+static uint64_t now_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/******************************************************************************
+ * @brief   The FNV-1a hash of some bytes.
+ *
+ * @param data      The bytes.
+ * @param size      The no. of bytes.
+ *
+ * @return  Their hash.
+ *****************************************************************************/
+static uint32_t hash_bytes(const void* data, size_t size)
+{
+    const unsigned char*    p = data;
+    uint32_t                h = 2166136261u;
+    for (size_t i = 0; i < size; ++i) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+uint32_t journal_hash(const char* s)
+{
+    return hash_bytes(s, strlen(s));
+}
+
+/******************************************************************************
+ * @brief   Fill in the time and the check of a record.
+ *
+ * @param r         The record.
+ *****************************************************************************/
+static void seal(struct journal_record* r)
+{
+    r->when     = now_ns(CLOCK_REALTIME);
+    r->reserved = 0;
+    r->check    = hash_bytes(r, offsetof(struct journal_record, check));
+}
+
+/******************************************************************************
+ * @brief   Write every buffered record. If the disk is full, they are lost.
+ *****************************************************************************/
+static void write_pending()
+{
+    const char* p       = (const char*)pending;
+    size_t      left    = pending_count * sizeof(*pending);
+    while (left > 0) {
+        ssize_t n = write(journal_fd, p, left);
+        if (n <= 0) {
+            break;
+        }
+        p       += n;
+        left    -= n;
+    }
+    unsynced        = unsynced || pending_count > 0;
+    pending_count   = 0;
+}
+
+/******************************************************************************
+ * @brief   Give up on opening the journal, freeing what was set up.
+ *
+ * @param block     The replay buffer, or NULL.
+ *
+ * @return  -1.
+ *****************************************************************************/
+static long abandon(struct journal_record* block)
+{
+    free(block);
+    free(pending);
+    pending = NULL;
+    if (journal_fd != -1) {
+        close(journal_fd);
+        journal_fd = -1;
+    }
+    return -1;
+}
+
+long journal_open(
+    const char* path,
+    unsigned sync_ms,
+    void (*apply)(const struct journal_record*, void*),
+    void* arg
+)
+{
+    struct journal_record*  block   = malloc(REPLAY_BLOCK * sizeof(*block));
+    long                    count   = 0;
+    off_t                   valid   = 0;
+    bool                    torn    = false;
+    struct stat             st;
+    ssize_t                 n;
+
+    pending         = malloc(JOURNAL_BUF * sizeof(*pending));
+    journal_fd      = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    sync_interval   = (uint64_t)sync_ms * 1000000ULL;
+    last_sync       = now_ns(CLOCK_MONOTONIC);
+    if (block == NULL || pending == NULL || journal_fd == -1
+        || fstat(journal_fd, &st) == -1) {
+        return abandon(block);
+    }
+
+    /*
+    --  Replay the whole records with a valid check, the first being the
+    --  header. Anything after the first bad one is from a crash, but a file
+    --  that does not start with a whole valid header is not a journal.
+    */
+    while (!torn && (n = read(journal_fd, block, REPLAY_BLOCK * sizeof(*block))) > 0) {
+        size_t records = n / sizeof(*block);
+        for (size_t i = 0; i < records; ++i) {
+            const struct journal_record* r = &block[i];
+            bool intact = r->check == hash_bytes(r, offsetof(struct journal_record, check));
+            if (valid == 0 && (!intact || r->type != JOURNAL_HEADER)) {
+                return abandon(block);  // not a journal, leave it alone
+            }
+            if (!intact) {
+                torn = true;
+                break;
+            }
+            if (valid > 0) {
+                apply(r, arg);
+                count++;
+            }
+            valid += sizeof(*r);
+        }
+        if (n % sizeof(*block) != 0) {
+            torn = true;            // the last record was cut short
+        }
+    }
+    if (valid == 0 && st.st_size != 0) {
+        return abandon(block);      // shorter than a header, or unreadable
+    }
+    free(block);
+
+    /*
+    --  Cut off the torn tail, or start an empty file with its header.
+    */
+    if (ftruncate(journal_fd, valid) == -1 || lseek(journal_fd, valid, SEEK_SET) == -1) {
+        return abandon(NULL);
+    }
+    if (valid == 0) {
+        journal_append(JOURNAL_HEADER, 0, 0, 0, 0, 0);
+        journal_tick();
+    }
+    return count;
+}
+
+void journal_append(
+    uint32_t type,
+    uint32_t index,
+    uint32_t hash,
+    uint32_t generation,
+    int pid,
+    int status
+)
+{
+    if (journal_fd == -1) {
+        return;
+    }
+    if (pending_count == JOURNAL_BUF) {
+        write_pending();
+    }
+    struct journal_record* r = &pending[pending_count++];
+    r->type         = type;
+    r->index        = index;
+    r->hash         = hash;
+    r->generation   = generation;
+    r->pid          = pid;
+    r->status       = status;
+    seal(r);
+}
+
+void journal_tick()
+{
+    if (journal_fd == -1) {
+        return;
+    }
+    write_pending();
+    if (unsynced && now_ns(CLOCK_MONOTONIC) - last_sync >= sync_interval) {
+        fdatasync(journal_fd);
+        last_sync   = now_ns(CLOCK_MONOTONIC);
+        unsynced    = false;
+    }
+}
+
+int journal_timeout(int wait)
+{
+    if (journal_fd == -1 || !unsynced) {
+        return wait;
+    }
+    uint64_t    elapsed = now_ns(CLOCK_MONOTONIC) - last_sync;
+    int         due     = elapsed >= sync_interval
+                        ? 0
+                        : (int)((sync_interval - elapsed + 999999) / 1000000);
+    return wait < 0 || due < wait ? due : wait;
+}
+
+void journal_close()
+{
+    if (journal_fd != -1) {
+        write_pending();
+        if (unsynced) {
+            fdatasync(journal_fd);
+        }
+        close(journal_fd);
+        journal_fd = -1;
+    }
+    free(pending);
+    pending = NULL;
+}
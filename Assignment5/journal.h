@@ -0,0 +1,122 @@
+/******************************************************************************
+ *
+ * @file        journal.h
+ *
+ * @author      Luan Truong
+ *
+ * @brief       The run journal of proc_manager: an append-only file of fixed
+ *              size binary records of launches, exits, restarts and finished
+ *              commands, replayed on startup to resume only the commands that
+ *              were not finished.
+ *
+ * @version     0.1
+ *
+ * @date        April 2022
+ *
+ *****************************************************************************/
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/******************************************************************************
+ * @brief   The kinds of records.
+ *****************************************************************************/
+enum journal_event {
+    JOURNAL_HEADER = 0x4a4d5001,    /* first record of every journal */
+    JOURNAL_LAUNCH,                 /* a run was launched */
+    JOURNAL_EXIT,                   /* a run was reaped, with its status */
+    JOURNAL_RESTART,                /* a restart was scheduled */
+    JOURNAL_DONE                    /* a command will not run again */
+};
+
+/******************************************************************************
+ * @brief   One record of the journal, written as is.
+ *****************************************************************************/
+struct journal_record {
+    uint64_t            when;       /* wall clock time, in ns */
+    uint32_t            type;       /* the kind of record */
+    uint32_t            index;      /* the line index of the command */
+    uint32_t            hash;       /* journal_hash of the command line */
+    uint32_t            generation; /* no. of restarts before the run */
+    int32_t             pid;        /* the pid of the run, 0 if none */
+    int32_t             status;     /* wait status, or 1 if DONE succeeded */
+    uint32_t            reserved;   /* 0 */
+    uint32_t            check;      /* journal_hash of the bytes before */
+};
+
+/******************************************************************************
+ * @brief   The FNV-1a hash of a string, to tell whether the command on a line
+ *          is still the one a record is about.
+ *
+ * @param s         The string.
+ *
+ * @return  Its hash.
+ *****************************************************************************/
+uint32_t journal_hash(const char* s);
+
+/******************************************************************************
+ * @brief   Open the journal, creating it if needed, and replay every record
+ *          in it. A record torn by a crash ends the replay, and is cut off
+ *          the file, so that new records follow the last whole one.
+ *
+ * @param path      The path of the journal.
+ * @param sync_ms   The least time between two syncs of the journal to disk.
+ * @param apply     Called with each record replayed, but the header.
+ * @param arg       Passed to apply.
+ *
+ * @return  The no. of records replayed, or -1 if the file could not be used
+ *          as a journal.
+ *****************************************************************************/
+long journal_open(
+    const char* path,
+    unsigned sync_ms,
+    void (*apply)(const struct journal_record*, void*),
+    void* arg
+);
+
+/******************************************************************************
+ * @brief   Add a record to the journal. Records are buffered until the next
+ *          journal_tick, or until the buffer is full.
+ *
+ * @param type          The kind of record.
+ * @param index         The line index of the command.
+ * @param hash          The journal_hash of the command line.
+ * @param generation    The no. of restarts before the run.
+ * @param pid           The pid of the run, 0 if none.
+ * @param status        The wait status, or 1 if DONE succeeded.
+ *****************************************************************************/
+void journal_append(
+    uint32_t type,
+    uint32_t index,
+    uint32_t hash,
+    uint32_t generation,
+    int pid,
+    int status
+);
+
+/******************************************************************************
+ * @brief   Write the buffered records, and sync the journal to disk if the
+ *          last sync is at least sync_ms old. Called once per turn of the
+ *          event loop, so that all the records of a turn share a sync.
+ *****************************************************************************/
+void journal_tick();
+
+/******************************************************************************
+ * @brief   Shorten a wait of the event loop to the next sync that is due.
+ *
+ * @param wait      The wait in ms, -1 if none.
+ *
+ * @return  The wait in ms, -1 if none.
+ *****************************************************************************/
+int journal_timeout(int wait);
+
+/******************************************************************************
+ * @brief   Write and sync every buffered record, then close the journal.
+ *****************************************************************************/
+void journal_close();
+
+#endif
@@ -0,0 +1,214 @@
+/******************************************************************************
+ *
+ * @file        pid_table.c
+ *
+ * @author      Luan Truong
+ *
+ * @brief       An open addressing table of running children, keyed by process
+ *              ID. Its size is a power of two, and it is probed linearly from
+ *              a multiplicative hash of the pid. A removed entry leaves a
+ *              tombstone, so that the probing of other entries is not cut
+ *              short. The table is rebuilt when it is 3/4 full of entries and
+ *              tombstones, doubling in size if half of it is entries.
+ *
+ * @version     0.1
+ *
+ * @date        April 2022
+ *
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pid_table.h"
+
+#define MIN_TABLE_BITS      7           /* 128 slots to begin with. */
+#define ARENA_BLOCK_SIZE    65536       /* Bytes in a usual arena block. */
+
+                /*******************************************/
+                /*                                         */
+                /*                Pid Table                */
+                /*                                         */
+                /*******************************************/
+
+static struct nlist*    table       = NULL; /* The slots. */
+static unsigned         table_bits  = 0;    /* log2 of the no. of slots. */
+static size_t           table_tombs = 0;    /* No. of removed slots. */
+size_t                  htable_count = 0;   /* No. of entries in table. */
+
+/******************************************************************************
+ * @brief   The hash function.
+ *
+ * @param pid       The process ID to be hashed.
+ *
+ * @return  The first slot to probe for the given process ID.
+ *****************************************************************************/
+static size_t _hash(int pid)
+{
+    return ((uint32_t)pid * 2654435769u) >> (32 - table_bits);
+}
+
+/******************************************************************************
+ * @brief   Rebuild the table with the given number of slots, dropping the
+ *          tombstones.
+ *
+ * @param bits      log2 of the new number of slots.
+ *
+ * @return  True if the table was rebuilt.
+ *****************************************************************************/
+static bool rehash(unsigned bits)
+{
+    struct nlist*   old     = table;
+    size_t          oldsize = table ? (size_t)1 << table_bits : 0;
+    struct nlist*   slots   = calloc((size_t)1 << bits, sizeof(*slots));
+
+    if (slots == NULL) {
+        return false;
+    }
+    table       = slots;
+    table_bits  = bits;
+    table_tombs = 0;
+
+    size_t mask = ((size_t)1 << bits) - 1;
+    for (size_t i = 0; i < oldsize; ++i) {
+        if (old[i].pid == PID_EMPTY || old[i].pid == PID_REMOVED) {
+            continue;
+        }
+        size_t slot = _hash(old[i].pid);
+        while (table[slot].pid != PID_EMPTY) {
+            slot = (slot + 1) & mask;
+        }
+        table[slot] = old[i];
+    }
+    free(old);
+    return true;
+}
+
+struct nlist* lookup(int pid)
+{
+    if (table == NULL || pid == PID_EMPTY || pid == PID_REMOVED) {
+        return NULL;
+    }
+    size_t mask = ((size_t)1 << table_bits) - 1;
+    for (size_t slot = _hash(pid); table[slot].pid != PID_EMPTY;
+         slot = (slot + 1) & mask) {
+        if (table[slot].pid == pid) {
+            return &table[slot];    // found
+        }
+    }
+    return NULL;                    // not found
+}
+
+struct nlist* insert(
+    int pid,
+    const char* command,
+    int index,
+    struct timespec starttime
+)
+{
+    struct nlist* np = lookup(pid);
+    /*
+    --  Case 1: The pid is not found.
+    --  Make room if needed, then take the first empty or removed slot.
+    */
+    if (np == NULL) {
+        size_t size = table ? (size_t)1 << table_bits : 0;
+        if ((htable_count + table_tombs + 1) * 4 > size * 3) {
+            unsigned bits = table ? table_bits : MIN_TABLE_BITS;
+            if ((htable_count + 1) * 2 > size && table) {
+                bits++;
+            }
+            if (!rehash(bits)) {
+                return NULL;
+            }
+        }
+        size_t mask = ((size_t)1 << table_bits) - 1;
+        size_t slot = _hash(pid);
+        while (table[slot].pid != PID_EMPTY && table[slot].pid != PID_REMOVED) {
+            slot = (slot + 1) & mask;
+        }
+        if (table[slot].pid == PID_REMOVED) {
+            table_tombs--;
+        }
+        np      = &table[slot];
+        np->pid = pid;
+        htable_count++;
+    }
+    /*
+    --  Case 2: The pid is already in the table.
+    --  Override the previous data with the new one.
+    */
+    np->command     = command;
+    np->index       = index;
+    np->starttime   = starttime;
+    np->deadline    = 0;
+    np->generation  = 0;
+    np->fdout       = -1;
+    np->fderr       = -1;
+    np->running     = true;
+
+    return np;
+}
+
+void remove_pid(int pid)
+{
+    struct nlist* np = lookup(pid);
+    if (np) {
+        np->pid = PID_REMOVED;
+        htable_count--;
+        table_tombs++;
+    }
+}
+
+                /*******************************************/
+                /*                                         */
+                /*               String Arena              */
+                /*                                         */
+                /*******************************************/
+
+/******************************************************************************
+ * @brief   A block of the arena. Strings are never moved once copied, so new
+ *          blocks are chained instead of growing old ones.
+ *****************************************************************************/
+struct arena_block {
+    struct arena_block* next;       /* the block filled before this one */
+    size_t              used;       /* bytes already taken */
+    size_t              size;       /* bytes in data */
+    char                data[];
+};
+
+static struct arena_block* arena = NULL;    /* The block being filled. */
+
+const char* arena_strdup(const char* s)
+{
+    size_t len = strlen(s) + 1;
+    if (arena == NULL || arena->size - arena->used < len) {
+        size_t              size    = len > ARENA_BLOCK_SIZE ? len : ARENA_BLOCK_SIZE;
+        struct arena_block* block   = malloc(sizeof(*block) + size);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->next = arena;
+        block->used = 0;
+        block->size = size;
+        arena       = block;
+    }
+    char* p = arena->data + arena->used;
+    memcpy(p, s, len);
+    arena->used += len;
+    return p;
+}
+
+void free_htable()
+{
+    free(table);
+    table           = NULL;
+    table_bits      = 0;
+    table_tombs     = 0;
+    htable_count    = 0;
+    while (arena) {
+        struct arena_block* next = arena->next;     // save the next block
+        free(arena);                                // free the block
+        arena = next;                               // move on to next block
+    }
+}
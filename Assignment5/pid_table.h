@@ -0,0 +1,96 @@
+/******************************************************************************
+ *
+ * @file        pid_table.h
+ *
+ * @author      Luan Truong
+ *
+ * @brief       The table of running children of proc_manager, keyed by process
+ *              ID, and the arena that holds the command lines they run.
+ *
+ * @version     0.1
+ *
+ * @date        April 2022
+ *
+ *****************************************************************************/
+
+#ifndef PID_TABLE_H
+#define PID_TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define PID_EMPTY       0           /* pid of a slot never used */
+#define PID_REMOVED     -1          /* pid of a slot whose entry was removed */
+
+/******************************************************************************
+ * @brief   One slot of the table, storing one child's info.
+ *****************************************************************************/
+struct nlist {
+    int                 pid;        /* the process ID, or PID_EMPTY/REMOVED */
+    size_t              index;      /* the line index in the input file */
+    const char*         command;    /* the command, kept in the arena */
+    struct timespec     starttime;  /* the start time */
+    uint64_t            deadline;   /* when to kill it, 0 if never */
+    unsigned            generation; /* no. of restarts before this run */
+    int                 fdout;      /* its .out file, -1 if not open */
+    int                 fderr;      /* its .err file, -1 if not open */
+    bool                running;    /* whether it has not exited yet */
+};
+
+extern size_t htable_count;         /* No. of entries in table. */
+
+/******************************************************************************
+ * @brief   Look for the given pid in the table.
+ *
+ * @param pid       The pid to look for.
+ *
+ * @return  The entry with the given pid. If no such entry exists, return
+ *          NULL. It stays valid until the next insert.
+ *****************************************************************************/
+struct nlist* lookup(int pid);
+
+/******************************************************************************
+ * @brief   Insert a new process ID and its command to the table. In case the
+ *          same process ID already existed in the table, replace its command
+ *          and index with the new ones. The command is not copied, it must
+ *          stay valid as long as the entry, e.g. by being in the arena.
+ *
+ * @param pid           The process ID.
+ * @param command       The command.
+ * @param index         The index.
+ * @param starttime     The time the command was executed
+ *
+ * @return  The entry inserted (or modified), or NULL if the table could not
+ *          grow. It stays valid until the next insert.
+ *****************************************************************************/
+struct nlist* insert(
+    int pid,
+    const char* command,
+    int index,
+    struct timespec starttime
+);
+
+/******************************************************************************
+ * @brief   Remove a process ID from the table, if it is there.
+ *
+ * @param pid       The process ID.
+ *****************************************************************************/
+void remove_pid(int pid);
+
+/******************************************************************************
+ * @brief   Free the table, and every string of the arena.
+ *****************************************************************************/
+void free_htable();
+
+/******************************************************************************
+ * @brief   Copy a string into the arena. It stays valid until free_htable.
+ *
+ * @param s         The string to copy.
+ *
+ * @return  The copy, or NULL if out of memory.
+ *****************************************************************************/
+const char* arena_strdup(const char* s);
+
+#endif
@@ -13,6 +13,8 @@
  * 
  *****************************************************************************/
 
+#define _GNU_SOURCE                 /* for CPU affinity */
+
 #include <stdlib.h>
 #include <fcntl.h>
 #include <time.h>
@@ -20,8 +22,25 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sched.h>
+
+#include "pid_table.h"
+#include "journal.h"
 
 #define CONSOLE_ERROR       "\033[0;31m%s\033[0;00m"
 #define RESTART_MSG         "RESTARTING...\n"
@@ -31,6 +50,45 @@
 #define TIME_THRESHOLD      2
 #define MAX_NUM_LINES       1024
 #define MAX_FNAME_LEN       15
+#define MAX_EVENTS          64
+#define MSG_IOV             8
+#define MSG_BUF             512
+#define KILLED_MSG          "Exceeded the deadline of %ds. Killed.\n"
+#define LOAD_POLL_MS        50
+#define MAX_RESTARTS_MSG    "Exceeded the limit time. Reached the limit of %d restarts.\n"
+#define PARKED_MSG          "Exceeded the limit time. Crashed %u times in a row. Parked.\n"
+#define BACKOFF_MSG         "Restarting in %.3fs...\n"
+#define DEFAULT_BACKOFF     0.5
+#define BACKOFF_CAP         30.0
+#define DEFAULT_CRASH_LIMIT 5
+#define DEFAULT_COST        1.0
+#define CAPTURE_BUF         65536
+#define CAPTURE_FLUSH_MS    1000
+#define CAPTURE_KEEP        3
+#define DEFAULT_ROTATE_SIZE (10 << 20)
+#define METRICS_CLIENTS     16
+#define REAP_BUCKETS        24
+#define RATE_WINDOW         10
+#define JOURNAL_SYNC_MS     100
+#define USAGE                                                                  \
+    "Usage: proc_manager [options] <textfile>\n"                              \
+    "  -k seconds       kill a child still running after that long\n"         \
+    "  -s fork|spawn    how to launch children (default: fork)\n"             \
+    "  -j jobs          most children running at once (default: any)\n"      \
+    "  -l               hold launches while the machine is busy\n"           \
+    "  -r restarts      most restarts of a command (default: any)\n"         \
+    "  -b seconds       delay before the first restart, doubled after each\n" \
+    "  -c crashes       park a command after that many crashes in a row\n"  \
+    "  -u file          write the resources used per command, as CSV if the\n" \
+    "                   file ends with .csv or JSON lines otherwise\n"       \
+    "  -o               capture the output of each command through pipes\n"  \
+    "  -R size          rotate captured output files at that size (10M)\n"   \
+    "  -t helpers       template mode: resolve each executable once, and keep\n" \
+    "                   that many children forked ahead to execute commands\n" \
+    "  -m socket        serve metrics on a Unix domain socket at that path\n" \
+    "  -J journal       record runs in a journal, and resume from it\n"      \
+    "  -F ms            least time between two syncs of the journal (100)\n"
+#define LOADAVG_PATH        "/proc/loadavg"
 
                 /*******************************************/
                 /*                                         */
@@ -57,19 +115,15 @@ double get_elapsed_time(struct timespec start_t, struct timespec end_t)
 }
 
 /******************************************************************************
- * @brief   Create a duplicate of a given string.
+ * @brief   Get the current time of the monotonic clock in nanoseconds.
  * 
- * @param s         The string to create duplicate for.
- * 
- * @return  The duplicated string created.
+ * @return  The current monotonic time.
  *****************************************************************************/
-char* duplicate_str(const char *s)
+uint64_t monotonic_ns()
 {
-    char* p = (char*) malloc(strlen(s) + 1);
-    if (p != NULL) {
-        strcpy(p, s);
-    }
-    return p;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
 }
 
 /******************************************************************************
@@ -89,23 +143,25 @@ const char* get_file_extension(const char* path)
 }
 
 /******************************************************************************
- * @brief   Check if the input arguments are valid.
+ * @brief   Check if the input arguments left after the options are valid.
  * 
  * @param argc      The arguments count.
- * @param argv      The arguments vector.
+ * @param argv      The arguments vector, starting at the first argument that
+ *                  is not an option.
  * 
  * @return  True if the input arguments are valid, false otherwise.
  *****************************************************************************/
 void validate_input(int argc, char** argv)
 {
     // if not enough arguments
-    if (argc != 2)
+    if (argc != 1)
     {
         printf(CONSOLE_ERROR, "Error: Invalid number of arguments.\n");
+        printf(USAGE);
         exit(1);
     }
     // check whether the file's extension is txt
-    char *filepath = *(argv + 1);
+    char *filepath = *argv;
     if (strcmp(get_file_extension(filepath), "txt") != 0)
     {
         printf(CONSOLE_ERROR, "Error: The argument input is not a text file");
@@ -114,28 +170,63 @@ void validate_input(int argc, char** argv)
 }
 
 /******************************************************************************
- * @brief   Count the number of tokens of a string after being tokenized.
+ * @brief   Read a size such as 512, 64K, 10M or 1G.
  * 
- * @param str       The string to be tokenized.
- * @param sep       The seperator.
+ * @param str       The size.
  * 
- * @return  Number of tokens.
+ * @return  The size in bytes.
  *****************************************************************************/
-size_t count_tokens(char* str, const char* sep) {
-    if (str == NULL) {
-        return 0;
+size_t parse_size(const char* str)
+{
+    char*   unit;
+    size_t  size = strtoull(str, &unit, 10);
+    switch (*unit) {
+    case 'g': case 'G':
+        size <<= 10;
+        // fall through
+    case 'm': case 'M':
+        size <<= 10;
+        // fall through
+    case 'k': case 'K':
+        size <<= 10;
     }
-    size_t  tokcount    = 0;                    // No. of tokens.
-    char*   dupstr      = duplicate_str(str);   // Duplicate of given string.
-    char*   token       = strtok(dupstr, sep);  // The first token.
+    return size;
+}
 
-    // loop through each token to count the no. of tokens
-    while (token) {
-        token = strtok(NULL, sep);
-        tokcount++;
+/******************************************************************************
+ * @brief   Read a list of CPUs such as 0-3,6.
+ * 
+ * @param list      The list.
+ * @param set       Where to store the CPUs.
+ * 
+ * @return  True if the list is valid and not empty.
+ *****************************************************************************/
+bool parse_cpus(const char* list, cpu_set_t* set)
+{
+    CPU_ZERO(set);
+    while (*list) {
+        char*   end;
+        long    first   = strtol(list, &end, 10);
+        long    last    = first;
+        if (end == list || first < 0) {
+            return false;
+        }
+        if (*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if (end == list || last < first) {
+                return false;
+            }
+        }
+        if (last >= CPU_SETSIZE || (*end != ',' && *end != '\0')) {
+            return false;
+        }
+        for (long cpu = first; cpu <= last; ++cpu) {
+            CPU_SET(cpu, set);
+        }
+        list = end + (*end == ',');
     }
-    free(dupstr);
-    return tokcount;
+    return CPU_COUNT(set) > 0;
 }
 
 /******************************************************************************
@@ -152,17 +243,20 @@ void trim_newline(char* str)
 }
 
 /******************************************************************************
- * @brief   Redirect the given file descriptor to an output file.
+ * @brief   Open the output file of a process for appending, without touching
+ *          the file descriptors of the caller. It is closed on exec, so other
+ *          children do not inherit it.
  * 
  * @param pid       The process ID, which will be used as the name of the
  *                  output file.
- * @param fd        The file descriptor. Should be either stdout or stderr
+ * @param fd        The file descriptor the file stands for. Should be either
+ *                  stdout or stderr
  * 
  * @return  The file descriptor of the ouput file.
  *****************************************************************************/
-int redirect_to_file(int pid, int fd)
+int open_output(int pid, int fd)
 {
-    
+
     char    fout[MAX_NUM_LINES];
     char*   extension;
     
@@ -179,11 +273,25 @@ int redirect_to_file(int pid, int fd)
         break;
     }
     sprintf(fout, "%d.%s", pid, extension);
-    int fdout = open(fout, O_RDWR | O_CREAT | O_APPEND);
-    fchmod(
-        fdout,
+    return open(
+        fout,
+        O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
         S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH
     );
+}
+
+/******************************************************************************
+ * @brief   Redirect the given file descriptor to an output file.
+ * 
+ * @param pid       The process ID, which will be used as the name of the
+ *                  output file.
+ * @param fd        The file descriptor. Should be either stdout or stderr
+ * 
+ * @return  The file descriptor of the ouput file.
+ *****************************************************************************/
+int redirect_to_file(int pid, int fd)
+{
+    int fdout = open_output(pid, fd);
     if (fdout != -1) {
         dup2(fdout, fd);
     }
@@ -192,335 +300,3155 @@ int redirect_to_file(int pid, int fd)
 
                 /*******************************************/
                 /*                                         */
-                /*                Hash Table               */
+                /*              Child Messages             */
                 /*                                         */
                 /*******************************************/
 
-#define HASHSIZE        101
-
 /******************************************************************************
- * @brief   A node to store one command's info in the hash table
+ * @brief   Messages about a child gathered to be written to one of its output
+ *          files at once. Constant strings are pointed to, formatted ones are
+ *          kept in buf.
  *****************************************************************************/
-struct nlist {
-    struct nlist*       next;       /* next entry in chain */
-    int                 pid;        /* the process ID */
-    size_t              index;      /* the line index in the input file */
-    char*               command;    /* the command stored */
-    struct timespec     starttime;  /* the start time */
+struct child_msg {
+    struct iovec        iov[MSG_IOV];   /* the messages */
+    int                 count;          /* no. of messages */
+    size_t              used;           /* bytes of buf taken */
+    char                buf[MSG_BUF];   /* the formatted messages */
 };
 
-static struct nlist*    hashtab[HASHSIZE];  /* Pointer table. */
-size_t                  htable_count = 0;   /* No. of elements in table */
+/******************************************************************************
+ * @brief   Add a constant string to a message.
+ * 
+ * @param msg       The message.
+ * @param str       The string, which must outlive the message.
+ *****************************************************************************/
+void msg_puts(struct child_msg* msg, const char* str)
+{
+    if (msg->count < MSG_IOV) {
+        msg->iov[msg->count].iov_base  = (void*)str;
+        msg->iov[msg->count].iov_len   = strlen(str);
+        msg->count++;
+    }
+}
 
 /******************************************************************************
- * @brief   The hash function.
+ * @brief   Add a formatted string to a message. It is cut short if the buffer
+ *          of the message is full.
  * 
- * @param pid       The process ID to be hashed.
+ * @param msg       The message.
+ * @param fmt       The format, as for printf.
+ *****************************************************************************/
+void msg_printf(struct child_msg* msg, const char* fmt, ...)
+{
+    size_t  room = MSG_BUF - msg->used;
+    va_list args;
+    if (msg->count == MSG_IOV || room <= 1) {
+        return;
+    }
+    va_start(args, fmt);
+    int len = vsnprintf(msg->buf + msg->used, room, fmt, args);
+    va_end(args);
+    if (len < 0) {
+        return;
+    }
+    if ((size_t)len >= room) {
+        len = room - 1;
+    }
+    msg->iov[msg->count].iov_base  = msg->buf + msg->used;
+    msg->iov[msg->count].iov_len   = len;
+    msg->count++;
+    msg->used += len;
+}
+
+/******************************************************************************
+ * @brief   Write a message with one writev, and empty it.
  * 
- * @return  The hash result based on the given process ID.
+ * @param msg       The message.
+ * @param fd        The file to write to. Nothing is written if it is -1.
  *****************************************************************************/
-unsigned _hash(int pid)
+void msg_flush(struct child_msg* msg, int fd)
 {
-    return pid % HASHSIZE;
+    if (msg->count > 0 && fd != -1) {
+        writev(fd, msg->iov, msg->count);
+    }
+    msg->count  = 0;
+    msg->used   = 0;
 }
 
 /******************************************************************************
- * @brief   Look for the given pid in hashtab.
+ * @brief   Get an output file of a child, opening it the first time only. It
+ *          stays open until close_child_files.
  * 
- * @param pid       The pid to look for.
+ * @param entry     The child.
+ * @param fd        Either stdout or stderr.
  * 
- * @return  The node with the given pid. If no such node exists, return NULL.
+ * @return  The file descriptor of the output file, or -1 if it cannot open.
  *****************************************************************************/
-struct nlist* lookup(int pid)
+int child_file(struct nlist* entry, int fd)
 {
-    struct nlist *np = hashtab[_hash(pid)];
-    while (np) {
-        if (pid == np->pid) {
-            return np;          // found
-        }
-        np = np->next;
+    int* cached = fd == STDERR_FILENO ? &entry->fderr : &entry->fdout;
+    if (*cached == -1) {
+        *cached = open_output(entry->pid, fd);
     }
-    return NULL;                // not found
+    return *cached;
 }
 
 /******************************************************************************
- * @brief   Insert a new process ID and its command to the hash table. In case
- *          the same process ID already existed in the table, replace its
- *          command and index with the new ones.
+ * @brief   Close the output files of a child that were opened.
  * 
- * @param pid           The process ID.
- * @param command       The command.
- * @param index         The index.
- * @param starttime     The time the command was executed
- * 
- * @return  The node inserted (or modified)
+ * @param entry     The child.
  *****************************************************************************/
-struct nlist* insert(
-    int pid,
-    char* command,
-    int index,
-    struct timespec starttime
-)
+void close_child_files(struct nlist* entry)
 {
-    struct nlist*   np;
-    unsigned        hashval;
-    /*
-    --  Case 1: The pid is not found.
-    --  Create the pid using malloc.
-    */
-    if ((np = lookup(pid)) == NULL) {
-        // create the pid
-        np = (struct nlist*) malloc(sizeof(*np));
-        if (np == NULL || (np->command = duplicate_str(command)) == NULL) {
-            return NULL;
-        }
-        hashval             = _hash(pid);
-        np->pid             = pid;
-        np->next            = hashtab[hashval];
-        hashtab[hashval]    = np;
-        htable_count++;
+    if (entry->fdout != -1) {
+        close(entry->fdout);
+        entry->fdout = -1;
     }
-    /* 
-    --  Case 2: The pid is already in the hashslot.
-    --  Override the previous data with the new one.
-    */
-    else {
-        free((void*) np->command);
-        if ((np->command = duplicate_str(command)) == NULL) {
-            return NULL;
-        }
+    if (entry->fderr != -1) {
+        close(entry->fderr);
+        entry->fderr = -1;
+    }
+}
+
+/******************************************************************************
+ * @brief   Raise the limit of open files as high as allowed, since the output
+ *          file of every running child is kept open.
+ *****************************************************************************/
+void raise_file_limit()
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
     }
-    np->index       = index;
-    np->starttime   = starttime;
+}
+
+                /*******************************************/
+                /*                                         */
+                /*               Deadline Heap             */
+                /*                                         */
+                /*******************************************/
+
+/******************************************************************************
+ * @brief   What happens when a deadline passes.
+ *****************************************************************************/
+enum deadline_kind {
+    DEADLINE_KILL,              /* a running child is killed */
+    DEADLINE_RESTART            /* a command waiting for backoff is queued */
+};
+
+/******************************************************************************
+ * @brief   A point in time at which something has to be done.
+ *****************************************************************************/
+struct deadline {
+    uint64_t            when;       /* monotonic time, in nanoseconds */
+    enum deadline_kind  kind;       /* what to do */
+    int                 pid;        /* the child to be killed or restarted */
+    size_t              index;      /* the line index of the command */
+};
 
-    return np;
+static struct deadline* dheap       = NULL; /* Min-heap on `when`. */
+size_t                  dheap_count = 0;    /* No. of deadlines in heap. */
+size_t                  dheap_size  = 0;    /* Capacity of the heap. */
+
+/******************************************************************************
+ * @brief   Add a deadline to the heap.
+ * 
+ * @param when      The monotonic time, in nanoseconds.
+ * @param kind      What to do at that time.
+ * @param pid       The child to be killed or restarted at that time.
+ * @param index     The line index of the command.
+ * 
+ * @return  True if the deadline was added.
+ *****************************************************************************/
+bool deadline_push(uint64_t when, enum deadline_kind kind, int pid, size_t index)
+{
+    if (dheap_count == dheap_size) {
+        size_t              size = dheap_size ? dheap_size * 2 : 64;
+        struct deadline*    heap = realloc(dheap, size * sizeof(*heap));
+        if (heap == NULL) {
+            return false;
+        }
+        dheap       = heap;
+        dheap_size  = size;
+    }
+    size_t i = dheap_count++;
+    while (i > 0 && dheap[(i - 1) / 2].when > when) {
+        dheap[i]    = dheap[(i - 1) / 2];
+        i           = (i - 1) / 2;
+    }
+    dheap[i].when   = when;
+    dheap[i].kind   = kind;
+    dheap[i].pid    = pid;
+    dheap[i].index  = index;
+    return true;
 }
 
-void free_htable()
+/******************************************************************************
+ * @brief   Remove the earliest deadline from the heap.
+ * 
+ * @return  The deadline removed.
+ *****************************************************************************/
+struct deadline deadline_pop()
 {
-    for (size_t i = 0; i < HASHSIZE; ++i) {
-        struct nlist* element = hashtab[i];
-        while (element) {
-            struct nlist* next = element->next;     // save the next node
-            free(element->command);                 // free the command
-            free(element);                          // free the element
-            element = next;                         // move on to next node
+    struct deadline top     = dheap[0];
+    struct deadline last    = dheap[--dheap_count];
+    size_t          i       = 0;
+
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= dheap_count) {
+            break;
+        }
+        if (child + 1 < dheap_count && dheap[child + 1].when < dheap[child].when) {
+            child++;
         }
+        if (dheap[child].when >= last.when) {
+            break;
+        }
+        dheap[i]    = dheap[child];
+        i           = child;
+    }
+    if (dheap_count > 0) {
+        dheap[i] = last;
     }
+    return top;
+}
+
+/******************************************************************************
+ * @brief   Arm the timer to fire at the earliest deadline, or disarm it if
+ *          there is none.
+ * 
+ * @param tfd       The timerfd.
+ *****************************************************************************/
+void arm_timer(int tfd)
+{
+    struct itimerspec spec = { { 0, 0 }, { 0, 0 } };
+    if (dheap_count > 0) {
+        // an absolute time of 0 would disarm the timer
+        uint64_t when           = dheap[0].when ? dheap[0].when : 1;
+        spec.it_value.tv_sec    = when / 1000000000ULL;
+        spec.it_value.tv_nsec   = when % 1000000000ULL;
+    }
+    timerfd_settime(tfd, TFD_TIMER_ABSTIME, &spec, NULL);
 }
 
                 /*******************************************/
                 /*                                         */
-                /*                  M A I N                */
+                /*              Command Stats              */
                 /*                                         */
                 /*******************************************/
 
-int main(int argc, char** argv)
+/******************************************************************************
+ * @brief   When and how often a command is restarted.
+ *****************************************************************************/
+struct restart_policy {
+    int                 max_restarts;   /* most restarts, -1 if unlimited */
+    double              backoff;        /* first restart delay, in seconds */
+    unsigned            crash_limit;    /* crashes in a row to park, 0 never */
+};
+
+struct restart_policy   default_policy = {
+    -1,
+    DEFAULT_BACKOFF,
+    DEFAULT_CRASH_LIMIT
+};
+
+/******************************************************************************
+ * @brief   The limits on the resources of each run of a command.
+ *****************************************************************************/
+struct command_limits {
+    long                cpu;        /* CPU seconds, 0 if unlimited */
+    size_t              memory;     /* bytes of memory, 0 if unlimited */
+    long                nofile;     /* open files, 0 if unchanged */
+    double              cpumax;     /* CPUs used at once, 0 if unlimited */
+    int                 nice;       /* niceness added */
+    const char*         cpus;       /* CPUs it may run on, NULL if any */
+};
+
+/******************************************************************************
+ * @brief   The attributes given to a line of the input file.
+ *****************************************************************************/
+struct command_spec {
+    struct restart_policy policy;   /* when to restart it */
+    const char*         id;         /* its name for `after`, NULL if none */
+    const char*         after;      /* names of its prerequisites, or NULL */
+    double              cost;       /* estimated run time, in seconds */
+    struct command_limits limits;   /* its limits */
+};
+
+/******************************************************************************
+ * @brief   A file the captured stdout or stderr of a command is written to,
+ *          through a buffer.
+ *****************************************************************************/
+struct capture_file {
+    bool                opened;     /* whether fd is open */
+    bool                listed;     /* whether it is in the dirty list */
+    int                 fd;         /* the file */
+    size_t              size;       /* bytes in the file */
+    char*               buf;        /* bytes not written yet */
+    size_t              used;       /* no. of bytes in buf */
+    uint64_t            dirty_since;    /* when buf stopped being empty */
+};
+
+/******************************************************************************
+ * @brief   What is known about the runs of one line of the input file.
+ *****************************************************************************/
+struct command_stats {
+    const char*         command;    /* the command line, in the arena */
+    char**              argv;       /* its arguments, split at load time */
+    const char*         path;       /* its executable, NULL to search PATH */
+    uint32_t            hash;       /* journal_hash of the command line */
+    struct restart_policy policy;   /* when to restart it */
+    const char*         id;         /* its name for `after`, NULL if none */
+    const char*         after;      /* names of its prerequisites, or NULL */
+    double              cost;       /* estimated run time, in seconds */
+    double              priority;   /* longest cost path from it to the end */
+    size_t*             dependents; /* the commands waiting for it */
+    size_t              ndependents;    /* no. of dependents */
+    unsigned            waiting;    /* no. of prerequisites not succeeded */
+    bool                succeeded;  /* whether a run exited with code 0 */
+    bool                cancelled;  /* whether a prerequisite failed */
+    bool                done;       /* finished before, as the journal says */
+    struct command_limits limits;   /* its limits */
+    bool                limited;    /* whether it has any limit */
+    cpu_set_t*          affinity;   /* CPUs it may run on, NULL if any */
+    const char*         cgroup;     /* cgroup.procs of its cgroup, or NULL */
+    unsigned            crashes;    /* no. of runs in a row that crashed */
+    bool                parked;     /* whether it was given up on */
+    unsigned            launches;   /* no. of runs launched */
+    size_t              nsamples;   /* no. of runs reaped */
+    size_t              size;       /* capacity of samples */
+    double*             samples;    /* elapsed time of each reaped run */
+    struct rusage       usage;      /* resources used by all runs */
+    struct capture_file capture[2]; /* its captured stdout and stderr */
+};
+
+static struct command_stats*    commands        = NULL; /* One per line. */
+size_t                          commands_count  = 0;    /* No. of lines. */
+size_t                          commands_size   = 0;    /* Capacity. */
+
+/******************************************************************************
+ * @brief   Record a line of the input file.
+ * 
+ * @param index     The line index in the input file.
+ * @param command   The command line, which must be in the arena.
+ * @param arglist   Its arguments, from tokenize_command. They are freed with
+ *                  the stats.
+ * @param spec      Its attributes. The strings are copied into the arena.
+ * 
+ * @return  True if it was recorded.
+ *****************************************************************************/
+bool add_command(
+    size_t index,
+    const char* command,
+    char** arglist,
+    const struct command_spec* spec
+)
 {
-    /*
-    --  Validate input arguments.
-    */
-    validate_input(argc, argv);
-    /*
-    --  Ignore the program name.
-    */
-    argc--;
-    argv++;
+    if (index >= commands_size) {
+        size_t                  size  = commands_size ? commands_size * 2 : 64;
+        struct command_stats*   stats;
+        while (size <= index) {
+            size *= 2;
+        }
+        stats = realloc(commands, size * sizeof(*stats));
+        if (stats == NULL) {
+            return false;
+        }
+        memset(stats + commands_size, 0, (size - commands_size) * sizeof(*stats));
+        commands        = stats;
+        commands_size   = size;
+    }
+    const char* id      = spec->id ? arena_strdup(spec->id) : NULL;
+    const char* after   = spec->after ? arena_strdup(spec->after) : NULL;
+    cpu_set_t*  cpus    = spec->limits.cpus ? malloc(sizeof(*cpus)) : NULL;
+    if ((spec->id && id == NULL) || (spec->after && after == NULL)
+        || (spec->limits.cpus && cpus == NULL)) {
+        free(cpus);
+        return false;
+    }
+    if (cpus) {
+        parse_cpus(spec->limits.cpus, cpus);
+    }
+    struct command_stats* cs = &commands[index];
+    cs->command     = command;
+    cs->argv        = arglist;
+    cs->hash        = journal_hash(command);
+    cs->policy      = spec->policy;
+    cs->id          = id;
+    cs->after       = after;
+    cs->cost        = spec->cost;
+    cs->priority    = spec->cost;
+    cs->limits      = spec->limits;
+    cs->limits.cpus = NULL;
+    cs->affinity    = cpus;
+    cs->limited     = cpus || spec->limits.cpu || spec->limits.memory
+                   || spec->limits.nofile || spec->limits.cpumax
+                   || spec->limits.nice;
+    if (index >= commands_count) {
+        commands_count = index + 1;
+    }
+    return true;
+}
 
-    printf("Reading from \"%s\"...\n", *argv);
+static const char* attribute_keys[] = {
+    "restarts", "backoff", "crashes", "id", "after", "cost",
+    "cpu", "as", "nofile", "cpumax", "nice", "cpus", NULL
+};
 
-    char                line[MAX_NUM_LINES];        // A line in the file.
-    FILE*               fptr = fopen(*argv, "r");   // The text file.
-    int                 pid;                        // The process ID.
-    struct timespec     starttime;                  // When execution started.
-    struct timespec     endtime;                    // When execution ended.
-    double              elapsed;                    // The elapsed time.
-    int                 status;                     // The wait status.
-    int                 fdout;                      // Out file descriptor.
-    int                 fderr;                      // Err file descriptor.
+/******************************************************************************
+ * @brief   Tell whether a bracket at the start of a line holds attributes,
+ *          i.e. only `key=value` words with known keys, rather than being a
+ *          command such as `[ -f file ]` or `[ "$a" = b ]`.
+ * 
+ * @param start     The character after the opening bracket.
+ * @param end       The closing bracket.
+ * 
+ * @return  True if every word in between starts with a known key and `=`.
+ *****************************************************************************/
+bool is_attribute_block(const char* start, const char* end)
+{
+    bool words = false;
+    for (;;) {
+        start += strspn(start, " \t");
+        if (start >= end) {
+            return words;
+        }
+        size_t len = strcspn(start, "= \t]");
+        bool known = false;
+        for (size_t k = 0; attribute_keys[k] && !known; ++k) {
+            known = strlen(attribute_keys[k]) == len
+                 && strncmp(attribute_keys[k], start, len) == 0;
+        }
+        if (!known || start[len] != '=') {
+            return false;
+        }
+        words = true;
+        start += len + strcspn(start + len, " \t]");
+    }
+}
 
-    /*
-    --  The first loop.
-    --  Read the commands in the text file.
-    --  Put them into the hash table, which is used for recording each exec.
-    */
-    for (size_t i = 0; fgets(line, MAX_NUM_LINES, fptr); ++i) {
-        /*
-        --  Tokenize the line read.
-        */
-        trim_newline(line);
-        char*   cmdline     = duplicate_str(line);
-        size_t  tokcount    = count_tokens(line, " ");
-        size_t  tidx        = 0;
-        char*   token       = strtok(line, " ");
-        char*   arglist[tokcount + 1];
-        while (token) {
-            arglist[tidx++] = token;
-            token           = strtok(NULL, " ");
-        }
-        arglist[tokcount]   = NULL;
-
-        pid = fork();
-        /*
-        --  If fork error.
-        */
-        if (pid < 0) {
-            fprintf(stderr, "Fork Error!");
-            exit(2);
+/******************************************************************************
+ * @brief   Read the attributes at the start of a line, in the form
+ *          `[key=value key=value] command`, and skip past them. The keys are:
+ *          restarts, backoff and crashes, overriding -r, -b and -c; id, the
+ *          name of the command; after, the comma separated names of the
+ *          commands that must succeed before it starts; cost, its
+ *          estimated run time in seconds, used to run the longest chains of
+ *          commands first; and the limits of each run: cpu (CPU seconds), as
+ *          (memory, e.g. 512M), nofile (open files), cpumax (CPUs used at
+ *          once, e.g. 0.5), nice (niceness added) and cpus (CPUs it may run
+ *          on, e.g. 0-3,6). A bracket that does not hold only known keys is
+ *          left as part of the command, so `[ -f file ]` still runs `[`.
+ * 
+ * @param line      The line, moved to the start of the command.
+ * @param spec      The attributes to be overridden. Its strings point into
+ *                  the line.
+ * 
+ * @return  True if the attributes are valid, or there are none.
+ *****************************************************************************/
+bool parse_attributes(char** line, struct command_spec* spec)
+{
+    struct restart_policy* policy = &spec->policy;
+    cpu_set_t cpus;
+    char* pos = *line + strspn(*line, " \t");
+    if (*pos != '[') {
+        return true;
+    }
+    char* end = strchr(pos, ']');
+    if (end == NULL || !is_attribute_block(pos + 1, end)) {
+        return true;                // a command starting with `[`
+    }
+    *end = '\0';
+    for (char* attr = strtok(pos + 1, " \t"); attr; attr = strtok(NULL, " \t")) {
+        char* value = strchr(attr, '=');
+        if (value == NULL) {
+            return false;
         }
-        /* 
-        --  If parent process.
-        */
-        else if (pid > 0) {
-            fdout = redirect_to_file(pid, STDOUT_FILENO);
-            clock_gettime(CLOCK_MONOTONIC, &starttime);
-            struct nlist* nentry = insert(pid, cmdline, i, starttime);
-            dprintf(
-                fdout,
-                "Child %d of parent %d.\n"
-                "Starting command `%s` at index %ld.\n\n",
-                pid,
-                getpid(),
-                nentry->command,
-                nentry->index
-            );
-            close(fdout);
+        *value++ = '\0';
+        if (strcmp(attr, "restarts") == 0) {
+            policy->max_restarts = atoi(value);
+        }
+        else if (strcmp(attr, "backoff") == 0) {
+            policy->backoff = atof(value);
+        }
+        else if (strcmp(attr, "crashes") == 0) {
+            policy->crash_limit = atoi(value);
+        }
+        else if (strcmp(attr, "id") == 0 && *value && !strchr(value, ',')) {
+            spec->id = value;
+        }
+        else if (strcmp(attr, "after") == 0 && *value) {
+            spec->after = value;
+        }
+        else if (strcmp(attr, "cost") == 0 && atof(value) >= 0) {
+            spec->cost = atof(value);
+        }
+        else if (strcmp(attr, "cpu") == 0 && atol(value) > 0) {
+            spec->limits.cpu = atol(value);
+        }
+        else if (strcmp(attr, "as") == 0 && parse_size(value) > 0) {
+            spec->limits.memory = parse_size(value);
+        }
+        else if (strcmp(attr, "nofile") == 0 && atol(value) > 0) {
+            spec->limits.nofile = atol(value);
+        }
+        else if (strcmp(attr, "cpumax") == 0 && atof(value) > 0) {
+            spec->limits.cpumax = atof(value);
+        }
+        else if (strcmp(attr, "nice") == 0) {
+            spec->limits.nice = atoi(value);
+        }
+        else if (strcmp(attr, "cpus") == 0 && parse_cpus(value, &cpus)) {
+            spec->limits.cpus = value;
         }
-        /*
-        --  If child process.
-        */
         else {
-            pid = getpid();
-            redirect_to_file(pid, STDOUT_FILENO); 
-            // Execute the command.
-            execvp(arglist[0], arglist);
+            return false;
         }
-        free(cmdline);
     }
+    *line = end + 1 + strspn(end + 1, " \t");
+    return true;
+}
 
-    /*
-    --  The second loop.
-    --  Wait until everything is finished.
-    --  When there is no more child process, the parent process will exit.
-    */
-    while ((pid = wait(&status)) >= 0) {
-        if (pid <= 0) {
-            continue;
-        }
-        struct nlist* entry = lookup(pid);
+/******************************************************************************
+ * @brief   Split a command line into its arguments, the way a shell would
+ *          with quotes but nothing else: arguments are separated by spaces or
+ *          tabs, nothing is special inside single quotes, and inside double
+ *          quotes a backslash only escapes ", \, $ and `. Outside of quotes a
+ *          backslash escapes any character.
+ * 
+ * @param command   The command line.
+ * @param arglist   Where to store the arguments, NULL to only count them.
+ * @param buf       Where to copy the arguments, at most as long as command.
+ * 
+ * @return  The number of arguments, or -1 if a quote is not closed.
+ *****************************************************************************/
+long split_command(const char* command, char** arglist, char* buf)
+{
+    const char* pos     = command;
+    long        argc    = 0;
 
-        /*
-        --  If normal exit.
-        */
-        if (WIFEXITED(status)) {
-            fderr = redirect_to_file(pid, STDERR_FILENO);
-            dprintf(
-                fderr,
-                "Child %d exits normally with code %d\n",
-                pid,
-                WEXITSTATUS(status)
-            );
-            close(fderr);
+    for (;;) {
+        pos += strspn(pos, " \t");
+        if (*pos == '\0') {
+            break;
         }
-        /*
-        --  If abnormal termination.
-        */
-        else if (WIFSIGNALED(status)) {
-            fderr = redirect_to_file(pid, STDERR_FILENO);
-            dprintf(
-                fderr,
-                "Child %d terminated abnormally with signal number %d\n",
-                pid,
-                WTERMSIG(status)
-            );
-            close(fderr);
+        if (arglist) {
+            arglist[argc] = buf;
         }
+        argc++;
 
-        clock_gettime(CLOCK_MONOTONIC, &endtime);
-        elapsed = get_elapsed_time(starttime, endtime);
-
-        /*
-        --  If 2 seconds have elapsed:
-        --  Restart the command in a new process.
-        */
-        if (elapsed > TIME_THRESHOLD) {
-            int ppid = pid;
-            fdout = redirect_to_file(pid, STDOUT_FILENO);
-            dprintf(fdout, EXCEED_TIME_MSG);
-            close(fdout);
-            pid = fork();
-
-            /*
-            --  If fork error.
-            */
-            if (pid < 0) {
-                fprintf(stderr, "Fork Error!");
-                exit(2);
+        char quote = 0;                     // the quote we are in, if any
+        while (*pos && (quote || (*pos != ' ' && *pos != '\t'))) {
+            char c = *pos++;
+            if (quote == 0 && (c == '\'' || c == '"')) {
+                quote = c;
+                continue;
             }
-            /*
-            --  If parent process.
-            */
-            else if (pid > 0) {
-                insert(pid, entry->command, entry->index, starttime);
+            if (c == quote) {
+                quote = 0;
+                continue;
             }
-            /*
-            --  If child process.
-            */
-            else {
-                char*   cmd         = entry->command;
-                size_t  tokcount    = count_tokens(cmd, " ");
-                size_t  tidx        = 0;
-                char*   token       = strtok(cmd, " ");
-                char*   arglist[tokcount + 1];
-                while (token) {
-                    arglist[tidx++] = token;
-                    token           = strtok(NULL, " ");
+            if (c == '\\' && quote != '\'' && *pos) {
+                if (quote == 0 || strchr("\"\\$`", *pos)) {
+                    c = *pos++;
                 }
-                arglist[tokcount]   = NULL;
-
-                pid     = getpid();
-                fdout   = redirect_to_file(pid, STDOUT_FILENO);
-
-                clock_gettime(CLOCK_MONOTONIC, &starttime);
-                dprintf(fdout, RESTART_MSG);
-                dprintf(
-                    fdout,
-                    "Child %d of parent %d.\n"
-                    "Restarting command `%s` at index %ld.\n\n",
-                    ppid,
-                    pid,
-                    entry->command,
-                    entry->index
-                );
-                close(fdout);
-                execvp(arglist[0], arglist);
+            }
+            if (buf) {
+                *buf++ = c;
             }
         }
-        /*
-        --  If command finished within 2 seconds:
-        --  Print the in time message to file and exit.
-        */
-        else {
-            clock_gettime(CLOCK_MONOTONIC, &endtime);
-            fderr = redirect_to_file(pid, STDERR_FILENO);
-            dprintf(fderr, IN_TIME_MSG);
-            close(fderr);
-            fdout = redirect_to_file(pid, STDOUT_FILENO);
-            dprintf(
-                fdout, 
-                "\nStarted at: %ld\nFinished at: %ld\nElapsed time: %fs",
-                entry->starttime.tv_sec,
-                endtime.tv_sec,
-                elapsed
-            );
-            close(fdout);
+        if (quote) {
+            return -1;
+        }
+        if (buf) {
+            *buf++ = '\0';
         }
     }
+    return argc;
+}
+
+/******************************************************************************
+ * @brief   Split a command line into its arguments once and for all. The
+ *          pointers and the strings they point to are in one block, to be
+ *          freed at once.
+ * 
+ * @param command   The command line.
+ * 
+ * @return  The arguments, ending with NULL, or NULL if a quote is not closed
+ *          or out of memory.
+ *****************************************************************************/
+char** tokenize_command(const char* command)
+{
+    long    argc    = split_command(command, NULL, NULL);
+    if (argc < 0) {
+        return NULL;
+    }
+    char**  arglist = malloc((argc + 1) * sizeof(char*) + strlen(command) + 1);
+    if (arglist == NULL) {
+        return NULL;
+    }
+    split_command(command, arglist, (char*)(arglist + argc + 1));
+    arglist[argc] = NULL;
+    return arglist;
+}
+
+/******************************************************************************
+ * @brief   A command name, to find commands by name.
+ *****************************************************************************/
+struct named_command {
+    const char*         id;         /* the name */
+    size_t              index;      /* the line index of the command */
+};
+
+/******************************************************************************
+ * @brief   The comparison of two command names for qsort and bsearch.
+ *****************************************************************************/
+int compare_names(const void* a, const void* b)
+{
+    return strcmp(
+        ((const struct named_command*)a)->id,
+        ((const struct named_command*)b)->id
+    );
+}
+
+/******************************************************************************
+ * @brief   Make a command wait for another.
+ * 
+ * @param prereq    The line index of the command to wait for.
+ * @param index     The line index of the command waiting.
+ * 
+ * @return  True if it was recorded.
+ *****************************************************************************/
+bool add_dependent(size_t prereq, size_t index)
+{
+    struct command_stats*   cs  = &commands[prereq];
+    size_t*                 deps;
+    // grow at every power of two
+    if ((cs->ndependents & (cs->ndependents - 1)) == 0) {
+        size_t size = cs->ndependents ? cs->ndependents * 2 : 1;
+        if ((deps = realloc(cs->dependents, size * sizeof(*deps))) == NULL) {
+            return false;
+        }
+        cs->dependents = deps;
+    }
+    cs->dependents[cs->ndependents++] = index;
+    commands[index].waiting++;
+    return true;
+}
+
+/******************************************************************************
+ * @brief   Link every command to the commands it comes after, and compute the
+ *          priority of each: the longest sum of costs along a chain of
+ *          commands starting with it. Running the commands with the longest
+ *          chains first keeps the whole run as short as possible.
+ * 
+ * @return  True if every name is known, and no command waits for itself.
+ *****************************************************************************/
+bool resolve_dependencies()
+{
+    struct named_command*   names   = malloc((commands_count + 1) * sizeof(*names));
+    size_t*                 order   = malloc((commands_count + 1) * sizeof(*order));
+    size_t                  nnames  = 0;
+    size_t                  norder  = 0;
+    bool                    valid   = names && order;
+
+    /*
+    --  Sort the names, to look them up with bsearch.
+    */
+    for (size_t i = 0; valid && i < commands_count; ++i) {
+        if (commands[i].command && commands[i].id) {
+            names[nnames].id        = commands[i].id;
+            names[nnames++].index   = i;
+        }
+    }
+    if (valid) {
+        qsort(names, nnames, sizeof(*names), compare_names);
+    }
+    for (size_t i = 1; valid && i < nnames; ++i) {
+        if (strcmp(names[i - 1].id, names[i].id) == 0) {
+            printf(CONSOLE_ERROR, "Error: Duplicate id ");
+            printf("`%s`.\n", names[i].id);
+            valid = false;
+        }
+    }
+
+    /*
+    --  Link each command to its prerequisites.
+    */
+    for (size_t i = 0; valid && i < commands_count; ++i) {
+        const char* pos = commands[i].command ? commands[i].after : NULL;
+        while (valid && pos && *pos) {
+            size_t                  len = strcspn(pos, ",");
+            char                    id[len + 1];
+            struct named_command    key = { id, 0 };
+            struct named_command*   found;
+            memcpy(id, pos, len);
+            id[len] = '\0';
+            pos    += len + (pos[len] == ',');
+            if (len == 0) {
+                continue;
+            }
+            found = bsearch(&key, names, nnames, sizeof(*names), compare_names);
+            if (found == NULL) {
+                printf(CONSOLE_ERROR, "Error: Unknown id ");
+                printf("`%s` on line %ld.\n", id, i + 1);
+                valid = false;
+            }
+            else {
+                valid = add_dependent(found->index, i);
+            }
+        }
+    }
+
+    /*
+    --  Sort the commands so that each comes before the ones waiting for it,
+    --  then add up the costs from the last one back.
+    */
+    if (valid) {
+        unsigned* waiting = calloc(commands_count + 1, sizeof(*waiting));
+        for (size_t i = 0; waiting && i < commands_count; ++i) {
+            waiting[i] = commands[i].waiting;
+            if (commands[i].command && waiting[i] == 0) {
+                order[norder++] = i;
+            }
+        }
+        for (size_t k = 0; waiting && k < norder; ++k) {
+            struct command_stats* cs = &commands[order[k]];
+            for (size_t d = 0; d < cs->ndependents; ++d) {
+                if (--waiting[cs->dependents[d]] == 0) {
+                    order[norder++] = cs->dependents[d];
+                }
+            }
+        }
+        for (size_t i = 0; waiting && i < commands_count; ++i) {
+            if (waiting[i] != 0) {
+                printf(CONSOLE_ERROR, "Error: Circular dependency on line ");
+                printf("%ld.\n", i + 1);
+                valid = false;
+                break;
+            }
+        }
+        valid = valid && waiting;
+        free(waiting);
+    }
+    for (size_t k = norder; valid && k-- > 0;) {
+        struct command_stats*   cs      = &commands[order[k]];
+        double                  longest = 0;
+        for (size_t d = 0; d < cs->ndependents; ++d) {
+            if (commands[cs->dependents[d]].priority > longest) {
+                longest = commands[cs->dependents[d]].priority;
+            }
+        }
+        cs->priority = cs->cost + longest;
+    }
+
+    free(names);
+    free(order);
+    return valid;
+}
+
+/******************************************************************************
+ * @brief   Look for an executable in the directories of PATH, like execvp.
+ * 
+ * @param name      The name of the executable, without a slash.
+ * 
+ * @return  Its path in the arena, or NULL if it was not found.
+ *****************************************************************************/
+const char* search_path(const char* name)
+{
+    const char* dirs    = getenv("PATH");
+    size_t      namelen = strlen(name);
+    if (dirs == NULL) {
+        dirs = "/bin:/usr/bin";
+    }
+    while (*dirs) {
+        size_t      len     = strcspn(dirs, ":");
+        char        path[len + namelen + 3];
+        struct stat st;
+        if (len == 0) {
+            strcpy(path, "./");         // an empty entry is the cwd
+        }
+        else {
+            memcpy(path, dirs, len);
+            path[len] = '/';
+            path[len + 1] = '\0';
+        }
+        strcat(path, name);
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0) {
+            return arena_strdup(path);
+        }
+        dirs += len + (dirs[len] == ':');
+    }
+    return NULL;
+}
+
+/******************************************************************************
+ * @brief   Resolve the executable of every command once, looking each name up
+ *          in PATH only the first time it is seen, so that every launch can
+ *          exec the path directly. A name that is not found is left to execvp,
+ *          which reports it at launch.
+ *****************************************************************************/
+void resolve_paths()
+{
+    struct named_command*   names   = malloc((commands_count + 1) * sizeof(*names));
+    size_t                  nnames  = 0;
+    const char*             path    = NULL;
+
+    if (names == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < commands_count; ++i) {
+        if (commands[i].command && strchr(commands[i].argv[0], '/') == NULL) {
+            names[nnames].id        = commands[i].argv[0];
+            names[nnames++].index   = i;
+        }
+    }
+    qsort(names, nnames, sizeof(*names), compare_names);
+    for (size_t i = 0; i < nnames; ++i) {
+        if (i == 0 || strcmp(names[i - 1].id, names[i].id) != 0) {
+            path = search_path(names[i].id);
+        }
+        commands[names[i].index].path = path;
+    }
+    free(names);
+}
+
+/******************************************************************************
+ * @brief   Count a new launch of a command.
+ * 
+ * @param index     The line index of the command in the input file.
+ * 
+ * @return  The generation of the launch: 0 for the first run, n for the n-th
+ *          restart.
+ *****************************************************************************/
+unsigned command_generation(size_t index)
+{
+    return index < commands_count ? commands[index].launches++ : 0;
+}
+
+/******************************************************************************
+ * @brief   Record the elapsed time of a run of a command.
+ * 
+ * @param index     The line index of the command in the input file.
+ * @param elapsed   The elapsed time of the run, in seconds.
+ *****************************************************************************/
+void record_latency(size_t index, double elapsed)
+{
+    if (index >= commands_count) {
+        return;
+    }
+    struct command_stats* cs = &commands[index];
+    if (cs->nsamples == cs->size) {
+        size_t  size    = cs->size ? cs->size * 2 : 4;
+        double* samples = realloc(cs->samples, size * sizeof(*samples));
+        if (samples == NULL) {
+            return;
+        }
+        cs->samples = samples;
+        cs->size    = size;
+    }
+    cs->samples[cs->nsamples++] = elapsed;
+}
+
+/******************************************************************************
+ * @brief   Add the resources used by a run of a command to its total. The
+ *          max RSS is the largest of all runs, the rest are summed up.
+ * 
+ * @param index     The line index of the command in the input file.
+ * @param usage     The resources used by the run, from wait4.
+ *****************************************************************************/
+void record_usage(size_t index, const struct rusage* usage)
+{
+    if (index >= commands_count) {
+        return;
+    }
+    struct rusage* total = &commands[index].usage;
+    timeradd(&total->ru_utime, &usage->ru_utime, &total->ru_utime);
+    timeradd(&total->ru_stime, &usage->ru_stime, &total->ru_stime);
+    if (usage->ru_maxrss > total->ru_maxrss) {
+        total->ru_maxrss = usage->ru_maxrss;
+    }
+    total->ru_minflt    += usage->ru_minflt;
+    total->ru_majflt    += usage->ru_majflt;
+    total->ru_nvcsw     += usage->ru_nvcsw;
+    total->ru_nivcsw    += usage->ru_nivcsw;
+}
+
+/******************************************************************************
+ * @brief   Write a string as a quoted CSV field, or a JSON string.
+ * 
+ * @param fptr      The file to write to.
+ * @param str       The string.
+ * @param json      Whether to write a JSON string instead of a CSV field.
+ *****************************************************************************/
+void write_quoted(FILE* fptr, const char* str, bool json)
+{
+    fputc('"', fptr);
+    for (; *str; ++str) {
+        if (!json) {
+            if (*str == '"') {
+                fputc('"', fptr);           // "" is a quote in CSV
+            }
+            fputc(*str, fptr);
+        }
+        else if (*str == '"' || *str == '\\') {
+            fprintf(fptr, "\\%c", *str);
+        }
+        else if ((unsigned char)*str < 0x20) {
+            fprintf(fptr, "\\u%04x", *str);
+        }
+        else {
+            fputc(*str, fptr);
+        }
+    }
+    fputc('"', fptr);
+}
+
+/******************************************************************************
+ * @brief   Write the resources used by every command line that was run at
+ *          least once, as CSV if the file name ends with .csv, or as JSON
+ *          lines otherwise.
+ * 
+ * @param path      The file to write to.
+ *****************************************************************************/
+void write_usage_summary(const char* path)
+{
+    bool    json = strcmp(get_file_extension(path), "csv") != 0;
+    FILE*   fptr = fopen(path, "w");
+
+    if (fptr == NULL) {
+        perror(path);
+        return;
+    }
+    if (!json) {
+        fprintf(
+            fptr,
+            "index,command,runs,user_s,system_s,max_rss_kb,"
+            "minor_faults,major_faults,voluntary_cs,involuntary_cs\n"
+        );
+    }
+    for (size_t i = 0; i < commands_count; ++i) {
+        struct command_stats*   cs  = &commands[i];
+        struct rusage*          ru  = &cs->usage;
+        if (cs->nsamples == 0) {
+            continue;
+        }
+        double utime = ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6;
+        double stime = ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+        if (json) {
+            fprintf(fptr, "{\"index\":%ld,\"command\":", i);
+            write_quoted(fptr, cs->command, true);
+            fprintf(
+                fptr,
+                ",\"runs\":%ld,\"user_s\":%.6f,\"system_s\":%.6f,"
+                "\"max_rss_kb\":%ld,\"minor_faults\":%ld,"
+                "\"major_faults\":%ld,\"voluntary_cs\":%ld,"
+                "\"involuntary_cs\":%ld}\n",
+                cs->nsamples, utime, stime, ru->ru_maxrss, ru->ru_minflt,
+                ru->ru_majflt, ru->ru_nvcsw, ru->ru_nivcsw
+            );
+        }
+        else {
+            fprintf(fptr, "%ld,", i);
+            write_quoted(fptr, cs->command, false);
+            fprintf(
+                fptr,
+                ",%ld,%.6f,%.6f,%ld,%ld,%ld,%ld,%ld\n",
+                cs->nsamples, utime, stime, ru->ru_maxrss, ru->ru_minflt,
+                ru->ru_majflt, ru->ru_nvcsw, ru->ru_nivcsw
+            );
+        }
+    }
+    fclose(fptr);
+}
+
+/******************************************************************************
+ * @brief   The comparison of two samples for qsort.
+ *****************************************************************************/
+int compare_samples(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/******************************************************************************
+ * @brief   Print the distribution of elapsed times of every command line that
+ *          was run at least once.
+ *****************************************************************************/
+void print_latency_summary()
+{
+    printf(
+        "\n%5s %6s %9s %9s %9s %9s %9s  %s\n",
+        "index", "runs", "min", "p50", "p90", "max", "mean", "command"
+    );
+    for (size_t i = 0; i < commands_count; ++i) {
+        struct command_stats*   cs  = &commands[i];
+        size_t                  n   = cs->nsamples;
+        double                  sum = 0;
+        if (n == 0) {
+            continue;
+        }
+        qsort(cs->samples, n, sizeof(*cs->samples), compare_samples);
+        for (size_t j = 0; j < n; ++j) {
+            sum += cs->samples[j];
+        }
+        printf(
+            "%5ld %6ld %8.3fs %8.3fs %8.3fs %8.3fs %8.3fs  %s\n",
+            i,
+            n,
+            cs->samples[0],
+            cs->samples[(n - 1) / 2],
+            cs->samples[(n - 1) * 9 / 10],
+            cs->samples[n - 1],
+            sum / n,
+            cs->command
+        );
+    }
+}
+
+/******************************************************************************
+ * @brief   Free the stats of every command.
+ *****************************************************************************/
+void free_commands()
+{
+    for (size_t i = 0; i < commands_count; ++i) {
+        free(commands[i].argv);
+        free(commands[i].dependents);
+        free(commands[i].samples);
+        free(commands[i].affinity);
+    }
+    free(commands);
+}
+
+                /*******************************************/
+                /*                                         */
+                /*                Job Queue                */
+                /*                                         */
+                /*******************************************/
+
+/******************************************************************************
+ * @brief   A command waiting for a free slot to be launched.
+ *****************************************************************************/
+struct job {
+    const char*         command;    /* the command line, in the arena */
+    size_t              index;      /* the line index in the input file */
+    int                 prev_pid;   /* the run being restarted, 0 if none */
+    double              priority;   /* the priority of the command */
+    uint64_t            seq;        /* order in which it was queued */
+};
+
+static struct job*      jobs        = NULL; /* Heap of jobs, first first. */
+size_t                  queue_count = 0;    /* No. of jobs in queue. */
+static size_t           queue_size  = 0;    /* Capacity of the queue. */
+static uint64_t         queue_seq   = 0;    /* No. of jobs ever queued. */
+
+/******************************************************************************
+ * @brief   Whether a job is to be launched before another: the one with the
+ *          higher priority, or the one queued first.
+ *****************************************************************************/
+bool job_before(const struct job* a, const struct job* b)
+{
+    return a->priority > b->priority
+        || (a->priority == b->priority && a->seq < b->seq);
+}
+
+/******************************************************************************
+ * @brief   Add a command to the queue, behind the commands queued before it
+ *          with the same priority.
+ * 
+ * @param command   The command line, which must be in the arena.
+ * @param index     The line index of the command in the input file.
+ * @param prev_pid  The pid of the run being restarted, 0 for a first run.
+ *****************************************************************************/
+void enqueue(const char* command, size_t index, int prev_pid)
+{
+    if (queue_count == queue_size) {
+        size_t      size    = queue_size ? queue_size * 2 : 64;
+        struct job* heap    = realloc(jobs, size * sizeof(*heap));
+        if (heap == NULL) {
+            fprintf(stderr, "Unable to queue `%s`\n", command);
+            return;
+        }
+        jobs        = heap;
+        queue_size  = size;
+    }
+    struct job job = {
+        command,
+        index,
+        prev_pid,
+        index < commands_count ? commands[index].priority : 0,
+        queue_seq++
+    };
+    size_t i = queue_count++;
+    while (i > 0 && job_before(&job, &jobs[(i - 1) / 2])) {
+        jobs[i] = jobs[(i - 1) / 2];
+        i       = (i - 1) / 2;
+    }
+    jobs[i] = job;
+}
+
+/******************************************************************************
+ * @brief   Remove the job to be launched first from the queue.
+ * 
+ * @param jp        Where to store the job removed.
+ * 
+ * @return  False if the queue is empty.
+ *****************************************************************************/
+bool dequeue(struct job* jp)
+{
+    if (queue_count == 0) {
+        return false;
+    }
+    *jp = jobs[0];
+    struct job  last    = jobs[--queue_count];
+    size_t      i       = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= queue_count) {
+            break;
+        }
+        if (child + 1 < queue_count && job_before(&jobs[child + 1], &jobs[child])) {
+            child++;
+        }
+        if (!job_before(&jobs[child], &last)) {
+            break;
+        }
+        jobs[i] = jobs[child];
+        i       = child;
+    }
+    if (queue_count > 0) {
+        jobs[i] = last;
+    }
+    return true;
+}
+
+/******************************************************************************
+ * @brief   Free the queue.
+ *****************************************************************************/
+void free_queue()
+{
+    free(jobs);
+    jobs        = NULL;
+    queue_count = 0;
+    queue_size  = 0;
+}
+
+/******************************************************************************
+ * @brief   Check whether the machine already has at least as many runnable
+ *          tasks as online cores, according to the 4th field of /proc/loadavg
+ *          ("runnable/total"). Unlike the load averages, it is not delayed.
+ * 
+ * @return  True if no more command should be launched for now.
+ *****************************************************************************/
+bool overloaded()
+{
+    static long ncores      = 0;
+    int         runnable    = 0;
+    FILE*       fptr        = fopen(LOADAVG_PATH, "r");
+
+    if (fptr == NULL) {
+        return false;
+    }
+    if (ncores == 0) {
+        ncores = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (fscanf(fptr, "%*f %*f %*f %d/", &runnable) != 1) {
+        runnable = 0;
+    }
+    fclose(fptr);
+    return runnable - 1 >= ncores;          // not counting ourselves
+}
+
+                /*******************************************/
+                /*                                         */
+                /*              Output Capture             */
+                /*                                         */
+                /*******************************************/
+
+/******************************************************************************
+ * @brief   The command and stream a pipe from a child carries.
+ *****************************************************************************/
+struct pipe_end {
+    size_t              index;      /* the line index of the command */
+    int                 stream;     /* 0 for stdout, 1 for stderr */
+};
+
+/******************************************************************************
+ * @brief   A capture file with bytes waiting in its buffer.
+ *****************************************************************************/
+struct dirty_capture {
+    size_t              index;      /* the line index of the command */
+    int                 stream;     /* 0 for stdout, 1 for stderr */
+};
+
+bool                    capture_mode    = false;    /* Capture with pipes. */
+size_t                  rotate_size     = DEFAULT_ROTATE_SIZE;
+size_t                  open_pipes      = 0;    /* No. of pipes not at EOF. */
+static struct pipe_end* pipe_ends       = NULL; /* Indexed by fd. */
+static size_t           pipe_ends_size  = 0;    /* Capacity of pipe_ends. */
+static struct dirty_capture* dirty      = NULL; /* Buffers to be written. */
+static size_t           dirty_count     = 0;    /* No. of dirty buffers. */
+static size_t           dirty_size      = 0;    /* Capacity of dirty. */
+
+/******************************************************************************
+ * @brief   Get the name of a capture file, or of one of its rotated copies.
+ * 
+ * @param path      Where to store the name.
+ * @param index     The line index of the command.
+ * @param stream    0 for stdout, 1 for stderr.
+ * @param copy      The no. of the rotated copy, 0 for the file itself.
+ *****************************************************************************/
+void capture_path(char* path, size_t index, int stream, int copy)
+{
+    const char* extension = stream == 0 ? "out" : "err";
+    if (copy == 0) {
+        sprintf(path, "cmd-%ld.%s", index, extension);
+    }
+    else {
+        sprintf(path, "cmd-%ld.%s.%d", index, extension, copy);
+    }
+}
+
+/******************************************************************************
+ * @brief   Open a capture file for appending.
+ * 
+ * @param index     The line index of the command.
+ * @param stream    0 for stdout, 1 for stderr.
+ * 
+ * @return  True if it is open.
+ *****************************************************************************/
+bool capture_open(size_t index, int stream)
+{
+    struct capture_file*    cap = &commands[index].capture[stream];
+    struct stat             st;
+    char                    path[MAX_NUM_LINES];
+
+    capture_path(path, index, stream, 0);
+    cap->fd = open(
+        path,
+        O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+        S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH
+    );
+    cap->opened = cap->fd != -1;
+    cap->size   = cap->opened && fstat(cap->fd, &st) == 0 ? st.st_size : 0;
+    return cap->opened;
+}
+
+/******************************************************************************
+ * @brief   Move a full capture file to its first copy, shifting the older
+ *          copies along and dropping the oldest, then start a new file.
+ * 
+ * @param index     The line index of the command.
+ * @param stream    0 for stdout, 1 for stderr.
+ *****************************************************************************/
+void capture_rotate(size_t index, int stream)
+{
+    char from[MAX_NUM_LINES];
+    char to[MAX_NUM_LINES];
+
+    close(commands[index].capture[stream].fd);
+    for (int copy = CAPTURE_KEEP; copy > 0; --copy) {
+        capture_path(from, index, stream, copy - 1);
+        capture_path(to, index, stream, copy);
+        rename(from, to);
+    }
+    capture_open(index, stream);
+}
+
+/******************************************************************************
+ * @brief   Write the buffer of a capture file, rotating the file whenever it
+ *          reaches the rotation size.
+ * 
+ * @param index     The line index of the command.
+ * @param stream    0 for stdout, 1 for stderr.
+ *****************************************************************************/
+void capture_flush(size_t index, int stream)
+{
+    struct capture_file* cap = &commands[index].capture[stream];
+    if (cap->used > 0 && !cap->opened) {
+        capture_open(index, stream);
+    }
+    for (size_t done = 0; cap->opened && done < cap->used;) {
+        size_t length = cap->used - done;
+        if (rotate_size > 0) {
+            if (cap->size >= rotate_size) {
+                capture_rotate(index, stream);
+                continue;
+            }
+            if (length > rotate_size - cap->size) {
+                length = rotate_size - cap->size;
+            }
+        }
+        ssize_t n = write(cap->fd, cap->buf + done, length);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;                  // the disk is full, drop the rest
+        }
+        done        += n;
+        cap->size   += n;
+    }
+    cap->used           = 0;
+    cap->dirty_since    = 0;
+}
+
+/******************************************************************************
+ * @brief   Write the buffers that have waited long enough, or all of them.
+ * 
+ * @param all       Whether to write every buffer.
+ *****************************************************************************/
+void flush_captures(bool all)
+{
+    uint64_t    now     = monotonic_ns();
+    uint64_t    wait    = CAPTURE_FLUSH_MS * 1000000ULL;
+    size_t      kept    = 0;
+
+    for (size_t i = 0; i < dirty_count; ++i) {
+        struct capture_file* cap = &commands[dirty[i].index].capture[dirty[i].stream];
+        if (all || cap->used == 0 || now - cap->dirty_since >= wait) {
+            capture_flush(dirty[i].index, dirty[i].stream);
+            cap->listed = false;
+        }
+        else {
+            dirty[kept++] = dirty[i];
+        }
+    }
+    dirty_count = kept;
+}
+
+/******************************************************************************
+ * @brief   Read what a child wrote to one of its pipes straight into the
+ *          buffer of its capture file, writing the buffer out whenever it is
+ *          full. At the end of the pipe, close it and write the buffer out.
+ * 
+ * @param efd       The epoll instance.
+ * @param fd        The pipe.
+ *****************************************************************************/
+void read_pipe(int efd, int fd)
+{
+    size_t                  index   = pipe_ends[fd].index;
+    int                     stream  = pipe_ends[fd].stream;
+    struct capture_file*    cap     = &commands[index].capture[stream];
+
+    if (cap->buf == NULL && (cap->buf = malloc(CAPTURE_BUF)) == NULL) {
+        char drop[4096];
+        while (read(fd, drop, sizeof(drop)) > 0);
+        return;
+    }
+    for (;;) {
+        ssize_t n = read(fd, cap->buf + cap->used, CAPTURE_BUF - cap->used);
+        if (n > 0) {
+            if (cap->used == 0) {
+                cap->dirty_since = monotonic_ns();
+            }
+            cap->used += n;
+            if (cap->used == CAPTURE_BUF) {
+                capture_flush(index, stream);
+            }
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN) {
+            break;
+        }
+        /*
+        --  End of the pipe: every process holding it has exited. It is taken
+        --  out of epoll first, as a child forked since may hold a copy.
+        */
+        epoll_ctl(efd, EPOLL_CTL_DEL, fd, NULL);
+        close(fd);
+        open_pipes--;
+        capture_flush(index, stream);
+        return;
+    }
+    if (cap->used > 0 && !cap->listed) {
+        if (dirty_count == dirty_size) {
+            size_t                  size    = dirty_size ? dirty_size * 2 : 64;
+            struct dirty_capture*   list    = realloc(dirty, size * sizeof(*list));
+            if (list == NULL) {
+                capture_flush(index, stream);
+                return;
+            }
+            dirty       = list;
+            dirty_size  = size;
+        }
+        dirty[dirty_count].index    = index;
+        dirty[dirty_count].stream   = stream;
+        dirty_count++;
+        cap->listed = true;
+    }
+}
+
+/******************************************************************************
+ * @brief   Create the stdout and stderr pipes of a child. Neither end is
+ *          inherited by other children.
+ * 
+ * @param reads     Where to store the ends read by the supervisor, for its
+ *                  stdout then its stderr.
+ * @param ends      Where to store the ends written by the child.
+ * 
+ * @return  True if the pipes were created.
+ *****************************************************************************/
+bool open_capture_pipes(int reads[2], int ends[2])
+{
+    int fds[2][2];
+    if (pipe(fds[0]) == -1) {
+        return false;
+    }
+    if (pipe(fds[1]) == -1) {
+        close(fds[0][0]);
+        close(fds[0][1]);
+        return false;
+    }
+    for (int stream = 0; stream < 2; ++stream) {
+        fcntl(fds[stream][0], F_SETFD, FD_CLOEXEC);     // only one thread forks
+        fcntl(fds[stream][1], F_SETFD, FD_CLOEXEC);
+        reads[stream]   = fds[stream][0];
+        ends[stream]    = fds[stream][1];
+    }
+    return true;
+}
+
+/******************************************************************************
+ * @brief   Start reading a capture pipe of a child, without blocking, when
+ *          epoll finds output in it. If it cannot be watched, it is closed.
+ * 
+ * @param efd       The epoll instance.
+ * @param rfd       The end of the pipe read by the supervisor.
+ * @param index     The line index of the command.
+ * @param stream    0 for stdout, 1 for stderr.
+ *****************************************************************************/
+void watch_pipe(int efd, int rfd, size_t index, int stream)
+{
+    struct epoll_event ev;
+    if ((size_t)rfd >= pipe_ends_size) {
+        size_t              size = pipe_ends_size ? pipe_ends_size : 64;
+        struct pipe_end*    map;
+        while (size <= (size_t)rfd) {
+            size *= 2;
+        }
+        if ((map = realloc(pipe_ends, size * sizeof(*map))) != NULL) {
+            pipe_ends       = map;
+            pipe_ends_size  = size;
+        }
+    }
+    if ((size_t)rfd < pipe_ends_size) {
+        pipe_ends[rfd].index    = index;
+        pipe_ends[rfd].stream   = stream;
+        ev.events               = EPOLLIN;
+        ev.data.fd              = rfd;
+        fcntl(rfd, F_SETFL, O_NONBLOCK);
+    }
+    if ((size_t)rfd >= pipe_ends_size || epoll_ctl(efd, EPOLL_CTL_ADD, rfd, &ev)) {
+        close(rfd);                 // the child gets SIGPIPE if it writes
+    }
+    else {
+        open_pipes++;
+    }
+}
+
+/******************************************************************************
+ * @brief   Write every buffer and close every capture file.
+ *****************************************************************************/
+void close_captures()
+{
+    flush_captures(true);
+    for (size_t i = 0; i < commands_count; ++i) {
+        for (int stream = 0; stream < 2; ++stream) {
+            struct capture_file* cap = &commands[i].capture[stream];
+            if (cap->opened) {
+                close(cap->fd);
+            }
+            free(cap->buf);
+        }
+    }
+    free(dirty);
+    free(pipe_ends);
+}
+
+                /*******************************************/
+                /*                                         */
+                /*             Resource Limits             */
+                /*                                         */
+                /*******************************************/
+
+static char*        cgroup_parent   = NULL; /* Where command cgroups go. */
+static char*        cgroup_leaf     = NULL; /* Where the supervisor moved. */
+
+/******************************************************************************
+ * @brief   Write a short text to a file, such as a cgroup interface file.
+ * 
+ * @param path      The path of the file.
+ * @param text      The text.
+ * 
+ * @return  True if it was all written.
+ *****************************************************************************/
+bool write_file(const char* path, const char* text)
+{
+    int     fd  = open(path, O_WRONLY | O_CLOEXEC);
+    size_t  len = strlen(text);
+    bool    ok  = fd != -1 && write(fd, text, len) == (ssize_t)len;
+    if (fd != -1) {
+        close(fd);
+    }
+    return ok;
+}
+
+/******************************************************************************
+ * @brief   Find the cgroup v2 directory the supervisor runs in, from the
+ *          mount point of cgroup2 and the `0::` line of /proc/self/cgroup.
+ * 
+ * @param path      Where to store its path, of MAX_NUM_LINES bytes.
+ * 
+ * @return  True if it was found.
+ *****************************************************************************/
+bool find_cgroup(char* path)
+{
+    char    line[MAX_NUM_LINES];
+    char    mount[MAX_NUM_LINES];
+    char    type[64];
+    bool    found   = false;
+    FILE*   fptr    = fopen("/proc/self/mounts", "r");
+
+    while (fptr && !found && fgets(line, sizeof(line), fptr)) {
+        found = sscanf(line, "%*s %1023s %63s", mount, type) == 2
+             && strcmp(type, "cgroup2") == 0;
+    }
+    if (fptr) {
+        fclose(fptr);
+    }
+    fptr = found ? fopen("/proc/self/cgroup", "r") : NULL;
+    found = false;
+    while (fptr && !found && fgets(line, sizeof(line), fptr)) {
+        trim_newline(line);
+        if (strncmp(line, "0::", 3) == 0) {
+            found = snprintf(path, MAX_NUM_LINES, "%s%s", mount, line + 3) < MAX_NUM_LINES;
+        }
+    }
+    if (fptr) {
+        fclose(fptr);
+    }
+    return found;
+}
+
+/******************************************************************************
+ * @brief   Get ready to give commands cgroups of their own, under the cgroup
+ *          of the supervisor, with the memory and cpu controllers. A cgroup
+ *          with processes cannot hand controllers down to others, so the
+ *          supervisor first moves itself to a cgroup of its own if needed.
+ * 
+ * @return  True if cgroups can be used.
+ *****************************************************************************/
+bool setup_cgroups()
+{
+    char base[MAX_NUM_LINES];
+    char leaf[MAX_NUM_LINES + 64];
+    char file[MAX_NUM_LINES + 128];
+
+    if (!find_cgroup(base)) {
+        return false;
+    }
+    sprintf(file, "%s/cgroup.subtree_control", base);
+    if (!write_file(file, "+memory +cpu")) {
+        sprintf(leaf, "%s/proc_manager-%d", base, getpid());
+        sprintf(file, "%s/cgroup.procs", leaf);
+        if (mkdir(leaf, 0755) == -1) {
+            return false;
+        }
+        if (!write_file(file, "0")) {
+            rmdir(leaf);
+            return false;
+        }
+        sprintf(file, "%s/cgroup.subtree_control", base);
+        if (!write_file(file, "+memory +cpu")) {
+            sprintf(file, "%s/cgroup.procs", base);
+            write_file(file, "0");
+            rmdir(leaf);
+            return false;       // other processes share the cgroup
+        }
+        cgroup_leaf = strdup(leaf);
+    }
+    cgroup_parent = strdup(base);
+    return cgroup_parent != NULL;
+}
+
+/******************************************************************************
+ * @brief   Create the cgroup of a command, with its memory.max and cpu.max.
+ * 
+ * @param index     The line index of the command.
+ * 
+ * @return  The path of the cgroup.procs file of the cgroup, in the arena, or
+ *          NULL if it could not be created.
+ *****************************************************************************/
+const char* create_cgroup(size_t index)
+{
+    const struct command_limits*    limits = &commands[index].limits;
+    char                            dir[MAX_NUM_LINES + 64];
+    char                            file[MAX_NUM_LINES + 128];
+    char                            value[64];
+    bool                            ok;
+
+    sprintf(dir, "%s/proc_manager-%d.%ld", cgroup_parent, getpid(), index);
+    if (mkdir(dir, 0755) == -1) {
+        return NULL;
+    }
+    sprintf(file, "%s/memory.max", dir);
+    sprintf(value, "%lu", limits->memory);
+    ok = limits->memory == 0 || write_file(file, value);
+    sprintf(file, "%s/cpu.max", dir);
+    sprintf(value, "%ld 100000", (long)(limits->cpumax * 100000));
+    ok = ok && (limits->cpumax == 0 || write_file(file, value));
+    if (!ok) {
+        rmdir(dir);
+        return NULL;
+    }
+    sprintf(file, "%s/cgroup.procs", dir);
+    return arena_strdup(file);
+}
+
+/******************************************************************************
+ * @brief   Give the commands with a memory or cpumax limit a cgroup of their
+ *          own, when cgroup v2 can be written to. The others get setrlimit,
+ *          which has no equivalent of cpumax.
+ *****************************************************************************/
+void setup_limits()
+{
+    bool tried      = false;
+    bool cgroups    = false;
+    bool warned     = false;
+    for (size_t i = 0; i < commands_count; ++i) {
+        struct command_stats* cs = &commands[i];
+        if (cs->command == NULL || (!cs->limits.memory && !cs->limits.cpumax)) {
+            continue;
+        }
+        if (!tried) {
+            tried   = true;
+            cgroups = setup_cgroups();
+        }
+        cs->cgroup = cgroups ? create_cgroup(i) : NULL;
+        if (cs->cgroup == NULL && cs->limits.cpumax && !warned) {
+            warned = true;
+            printf(CONSOLE_ERROR, "Warning: cgroup v2 cannot be used, ");
+            printf("so cpumax is ignored.\n");
+        }
+    }
+}
+
+/******************************************************************************
+ * @brief   Apply the limits of a command to the calling process, a child
+ *          about to execute it: join its cgroup, or set its memory with
+ *          setrlimit, then set the other limits.
+ * 
+ * @param cs        The command.
+ * 
+ * @return  True if every limit was applied.
+ *****************************************************************************/
+bool apply_limits(const struct command_stats* cs)
+{
+    const struct command_limits*    limits  = &cs->limits;
+    struct rlimit                   rl;
+    bool                            ok      = true;
+
+    if (cs->cgroup) {
+        ok = write_file(cs->cgroup, "0");
+    }
+    else if (limits->memory) {
+        rl.rlim_cur = rl.rlim_max = limits->memory;
+        ok = setrlimit(RLIMIT_AS, &rl) == 0;
+    }
+    if (ok && limits->cpu) {
+        rl.rlim_cur = limits->cpu;          // SIGXCPU, then SIGKILL a second later
+        rl.rlim_max = limits->cpu + 1;
+        ok = setrlimit(RLIMIT_CPU, &rl) == 0;
+    }
+    if (ok && limits->nofile) {
+        rl.rlim_cur = rl.rlim_max = limits->nofile;
+        ok = setrlimit(RLIMIT_NOFILE, &rl) == 0;
+    }
+    if (ok && limits->nice) {
+        errno = 0;
+        int niceness = getpriority(PRIO_PROCESS, 0);
+        ok = errno == 0 && setpriority(PRIO_PROCESS, 0, niceness + limits->nice) == 0;
+    }
+    if (ok && cs->affinity) {
+        ok = sched_setaffinity(0, sizeof(*cs->affinity), cs->affinity) == 0;
+    }
+    return ok;
+}
+
+/******************************************************************************
+ * @brief   Execute a command in a child, once its output is redirected, after
+ *          applying its limits. Does not return.
+ * 
+ * @param index     The line index of the command.
+ * @param arglist   Its arguments, ending with NULL.
+ *****************************************************************************/
+void exec_command(size_t index, char** arglist)
+{
+    if (commands[index].limited && !apply_limits(&commands[index])) {
+        perror("proc_manager: limits");
+        _exit(EXIT_FAILURE);
+    }
+    if (commands[index].path) {
+        execv(commands[index].path, arglist);
+    }
+    execvp(arglist[0], arglist);
+    _exit(EXIT_FAILURE);
+}
+
+/******************************************************************************
+ * @brief   Remove the cgroups of the commands, and move the supervisor back
+ *          to the cgroup it was started in.
+ *****************************************************************************/
+void remove_cgroups()
+{
+    char file[MAX_NUM_LINES + 64];
+    for (size_t i = 0; i < commands_count; ++i) {
+        if (commands[i].cgroup) {
+            char dir[MAX_NUM_LINES + 128];
+            strcpy(dir, commands[i].cgroup);
+            *strrchr(dir, '/') = '\0';
+            rmdir(dir);
+        }
+    }
+    if (cgroup_leaf) {
+        sprintf(file, "%s/cgroup.subtree_control", cgroup_parent);
+        write_file(file, "-memory -cpu");
+        sprintf(file, "%s/cgroup.procs", cgroup_parent);
+        write_file(file, "0");
+        rmdir(cgroup_leaf);
+    }
+    free(cgroup_leaf);
+    free(cgroup_parent);
+}
+
+                /*******************************************/
+                /*                                         */
+                /*               Zygote Pool               */
+                /*                                         */
+                /*******************************************/
+
+/******************************************************************************
+ * @brief   A child forked ahead of time, with its output already redirected,
+ *          waiting to be told which command to execute.
+ *****************************************************************************/
+struct zygote {
+    int                 pid;        /* its process ID */
+    int                 ctl;        /* the pipe its order is written to */
+    int                 reads[2];   /* its capture pipes, -1 if not capturing */
+};
+
+bool                    template_mode   = false;    /* Cache exec paths. */
+size_t                  pool_size       = 0;    /* No. of zygotes to keep. */
+size_t                  pool_count      = 0;    /* No. of zygotes waiting. */
+static struct zygote*   pool            = NULL; /* The zygotes waiting. */
+static int*             dead_zygotes    = NULL; /* Dropped, not reaped yet. */
+static size_t           dead_count      = 0;    /* No. of them. */
+
+/******************************************************************************
+ * @brief   The life of a zygote: wait for the line index of a command, then
+ *          execute it. It exits if the supervisor closes its pipe instead.
+ * 
+ * @param ctl       The pipe its order is read from.
+ * @param ends      The ends of its capture pipes, or NULL to write to its
+ *                  output file.
+ * @param mask      The signal mask to execute the command with.
+ *****************************************************************************/
+void zygote_main(int ctl, const int* ends, const sigset_t* mask)
+{
+    size_t  index;
+    ssize_t n;
+
+    if (ends) {
+        dup2(ends[0], STDOUT_FILENO);
+        dup2(ends[1], STDERR_FILENO);
+    }
+    else {
+        redirect_to_file(getpid(), STDOUT_FILENO);
+    }
+    while ((n = read(ctl, &index, sizeof(index))) == -1 && errno == EINTR);
+    if (n != sizeof(index) || index >= commands_count) {
+        _exit(EXIT_SUCCESS);        // retired, or the supervisor is gone
+    }
+    sigprocmask(SIG_SETMASK, mask, NULL);
+    exec_command(index, commands[index].argv);
+}
+
+/******************************************************************************
+ * @brief   Fork a new zygote into the pool.
+ * 
+ * @param mask      The signal mask to execute its command with.
+ * 
+ * @return  True if it was forked.
+ *****************************************************************************/
+bool fork_zygote(const sigset_t* mask)
+{
+    struct zygote   z = { -1, -1, { -1, -1 } };
+    int             ctl[2];
+    int             ends[2];
+
+    if (pool == NULL && (pool = malloc(pool_size * sizeof(*pool))) == NULL) {
+        return false;
+    }
+    if (pipe(ctl) == -1) {
+        return false;
+    }
+    fcntl(ctl[0], F_SETFD, FD_CLOEXEC);
+    fcntl(ctl[1], F_SETFD, FD_CLOEXEC);
+    if (capture_mode && !open_capture_pipes(z.reads, ends)) {
+        close(ctl[0]);
+        close(ctl[1]);
+        return false;
+    }
+    /*
+    --  The zygote closes the pipes of the others, so that each one sees the
+    --  end of its own pipe as soon as the supervisor closes it.
+    */
+    if ((z.pid = fork()) == 0) {
+        for (size_t i = 0; i < pool_count; ++i) {
+            close(pool[i].ctl);
+            if (pool[i].reads[0] != -1) {
+                close(pool[i].reads[0]);
+                close(pool[i].reads[1]);
+            }
+        }
+        close(ctl[1]);
+        if (capture_mode) {
+            close(z.reads[0]);
+            close(z.reads[1]);
+        }
+        zygote_main(ctl[0], capture_mode ? ends : NULL, mask);
+    }
+    close(ctl[0]);
+    if (capture_mode) {
+        close(ends[0]);
+        close(ends[1]);
+    }
+    if (z.pid < 0) {
+        close(ctl[1]);
+        if (capture_mode) {
+            close(z.reads[0]);
+            close(z.reads[1]);
+        }
+        return false;
+    }
+    z.ctl = ctl[1];
+    pool[pool_count++] = z;
+    return true;
+}
+
+/******************************************************************************
+ * @brief   Fork zygotes until the pool is full.
+ * 
+ * @param mask      The signal mask to execute their commands with.
+ *****************************************************************************/
+void fill_pool(const sigset_t* mask)
+{
+    while (pool_count < pool_size && fork_zygote(mask));
+}
+
+/******************************************************************************
+ * @brief   Close the pipes of a zygote taken out of the pool.
+ * 
+ * @param z         The zygote.
+ *****************************************************************************/
+void close_zygote(const struct zygote* z)
+{
+    close(z->ctl);
+    if (z->reads[0] != -1) {
+        close(z->reads[0]);
+        close(z->reads[1]);
+    }
+}
+
+/******************************************************************************
+ * @brief   Have a zygote of the pool execute a command. Its capture pipes,
+ *          if any, are then read like those of any other child.
+ * 
+ * @param efd       The epoll instance.
+ * @param index     The line index of the command.
+ * 
+ * @return  The pid of the zygote, or -1 if the pool is empty.
+ *****************************************************************************/
+int launch_zygote(int efd, size_t index)
+{
+    while (pool_count > 0) {
+        struct zygote z = pool[--pool_count];
+        if (write(z.ctl, &index, sizeof(index)) != sizeof(index)) {
+            close_zygote(&z);       // it died, it is reaped later
+            int* dead = realloc(dead_zygotes, (dead_count + 1) * sizeof(*dead));
+            if (dead) {
+                dead_zygotes = dead;
+                dead_zygotes[dead_count++] = z.pid;
+            }
+            continue;
+        }
+        close(z.ctl);
+        if (z.reads[0] != -1) {
+            watch_pipe(efd, z.reads[0], index, 0);
+            watch_pipe(efd, z.reads[1], index, 1);
+        }
+        return z.pid;
+    }
+    return -1;
+}
+
+/******************************************************************************
+ * @brief   Drop a reaped child from the pool if it is a zygote that was still
+ *          waiting, or one that was dropped when found dead, which only
+ *          happens if it was killed from outside.
+ * 
+ * @param pid       The pid of the child.
+ * 
+ * @return  True if it was a zygote.
+ *****************************************************************************/
+bool zygote_reaped(int pid)
+{
+    char fout[MAX_NUM_LINES];
+    sprintf(fout, "%d.out", pid);
+    for (size_t i = 0; i < pool_count; ++i) {
+        if (pool[i].pid == pid) {
+            close_zygote(&pool[i]);
+            pool[i] = pool[--pool_count];
+            unlink(fout);
+            return true;
+        }
+    }
+    for (size_t i = 0; i < dead_count; ++i) {
+        if (dead_zygotes[i] == pid) {
+            dead_zygotes[i] = dead_zygotes[--dead_count];
+            unlink(fout);
+            return true;
+        }
+    }
+    return false;
+}
+
+/******************************************************************************
+ * @brief   Let every zygote of the pool exit, remove their unused output
+ *          files, and free the pool.
+ *****************************************************************************/
+void retire_pool()
+{
+    char fout[MAX_NUM_LINES];
+    for (size_t i = 0; i < pool_count; ++i) {
+        close_zygote(&pool[i]);
+        waitpid(pool[i].pid, NULL, 0);
+        if (!capture_mode) {
+            sprintf(fout, "%d.out", pool[i].pid);
+            unlink(fout);
+        }
+    }
+    for (size_t i = 0; i < dead_count; ++i) {
+        waitpid(dead_zygotes[i], NULL, 0);
+        if (!capture_mode) {
+            sprintf(fout, "%d.out", dead_zygotes[i]);
+            unlink(fout);
+        }
+    }
+    pool_count = 0;
+    dead_count = 0;
+    free(pool);
+    free(dead_zygotes);
+}
+
+                /*******************************************/
+                /*                                         */
+                /*                 Metrics                 */
+                /*                                         */
+                /*******************************************/
+
+/******************************************************************************
+ * @brief   A connection to the metrics socket, whose report is not fully sent.
+ *****************************************************************************/
+struct metrics_client {
+    int                 fd;         /* the connection */
+    char*               buf;        /* the report */
+    size_t              len;        /* bytes in the report */
+    size_t              sent;       /* bytes already sent */
+};
+
+const char*         metrics_path    = NULL; /* Where to serve metrics. */
+int                 metrics_fd      = -1;   /* The listening socket. */
+static struct metrics_client clients[METRICS_CLIENTS];  /* Pending sends. */
+static size_t       nclients        = 0;    /* No. of pending sends. */
+static uint64_t     started_ns      = 0;    /* When the supervisor started. */
+static size_t       reaped_runs     = 0;    /* No. of runs reaped. */
+static size_t       launched_runs   = 0;    /* No. of runs launched. */
+static size_t       reap_hist[REAP_BUCKETS + 1];    /* Reap latencies. */
+static size_t       rate_count[RATE_WINDOW];    /* Launches per second. */
+static uint64_t     rate_second[RATE_WINDOW];   /* The second of each. */
+
+/******************************************************************************
+ * @brief   Count a launch, in the second it happened.
+ *****************************************************************************/
+void record_launch()
+{
+    uint64_t    second  = monotonic_ns() / 1000000000ULL;
+    size_t      slot    = second % RATE_WINDOW;
+    if (rate_second[slot] != second) {
+        rate_second[slot]   = second;
+        rate_count[slot]    = 0;
+    }
+    rate_count[slot]++;
+    launched_runs++;
+}
+
+/******************************************************************************
+ * @brief   Count a reap, in the histogram of reap latencies. Bucket i holds
+ *          the latencies of at most 2^i microseconds, and the last one the
+ *          longer ones.
+ * 
+ * @param latency   The time from the wake up of the supervisor by SIGCHLD
+ *                  until the child was reaped, in nanoseconds.
+ *****************************************************************************/
+void record_reap(uint64_t latency)
+{
+    uint64_t    us      = latency / 1000;
+    size_t      bucket  = 0;
+    while (bucket < REAP_BUCKETS && ((uint64_t)1 << bucket) < us) {
+        bucket++;
+    }
+    reap_hist[bucket]++;
+    reaped_runs++;
+}
+
+/******************************************************************************
+ * @brief   Write the report of the metrics socket, one metric per line.
+ * 
+ * @param fptr      The stream to write to.
+ * @param running   The no. of children running.
+ * @param delayed   The no. of restarts backing off.
+ *****************************************************************************/
+void write_metrics(FILE* fptr, size_t running, size_t delayed)
+{
+    uint64_t    now         = monotonic_ns();
+    uint64_t    second      = now / 1000000000ULL;
+    size_t      waiting     = 0;
+    size_t      window      = 0;
+    double      uptime      = (now - started_ns) / PRECISION;
+
+    for (size_t i = 0; i < commands_count; ++i) {
+        if (commands[i].command && commands[i].waiting > 0 && !commands[i].cancelled) {
+            waiting++;
+        }
+    }
+    for (size_t i = 0; i < RATE_WINDOW; ++i) {
+        if (second - rate_second[i] < RATE_WINDOW) {
+            window += rate_count[i];
+        }
+    }
+    fprintf(fptr, "uptime %.3f\n", uptime);
+    fprintf(fptr, "running %ld\n", running);
+    fprintf(fptr, "pending %ld\n", queue_count + delayed + waiting);
+    fprintf(fptr, "finished %ld\n", reaped_runs);
+    fprintf(fptr, "launches %ld\n", launched_runs);
+    fprintf(
+        fptr,
+        "spawn_rate %.2f\n",
+        window / (uptime < RATE_WINDOW ? (uptime > 1 ? uptime : 1) : RATE_WINDOW)
+    );
+    fprintf(fptr, "reap_latency_us");
+    for (size_t i = 0; i <= REAP_BUCKETS; ++i) {
+        if (reap_hist[i] == 0) {
+            continue;
+        }
+        if (i < REAP_BUCKETS) {
+            fprintf(fptr, " %lu:%ld", 1UL << i, reap_hist[i]);
+        }
+        else {
+            fprintf(fptr, " inf:%ld", reap_hist[i]);
+        }
+    }
+    fprintf(fptr, "\n");
+    for (size_t i = 0; i < commands_count; ++i) {
+        if (commands[i].command && commands[i].launches > 1) {
+            fprintf(fptr, "restarts %ld %u\n", i, commands[i].launches - 1);
+        }
+    }
+}
+
+/******************************************************************************
+ * @brief   Create the metrics socket, replacing any file left at its path,
+ *          and watch it with epoll.
+ * 
+ * @param efd       The epoll instance.
+ * @param path      The path of the socket.
+ * 
+ * @return  True if it is listening.
+ *****************************************************************************/
+bool open_metrics(int efd, const char* path)
+{
+    struct sockaddr_un  addr;
+    struct epoll_event  ev;
+
+    started_ns = monotonic_ns();
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    metrics_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (metrics_fd == -1) {
+        return false;
+    }
+    unlink(path);
+    ev.events   = EPOLLIN;
+    ev.data.fd  = metrics_fd;
+    if (bind(metrics_fd, (struct sockaddr*)&addr, sizeof(addr))
+        || listen(metrics_fd, METRICS_CLIENTS)
+        || epoll_ctl(efd, EPOLL_CTL_ADD, metrics_fd, &ev)) {
+        close(metrics_fd);
+        metrics_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+/******************************************************************************
+ * @brief   Send what the socket takes of the report of a client, without
+ *          blocking.
+ * 
+ * @param client    The client.
+ * 
+ * @return  True if the client is done with, and must be closed.
+ *****************************************************************************/
+bool send_report(struct metrics_client* client)
+{
+    while (client->sent < client->len) {
+        ssize_t n = send(
+            client->fd,
+            client->buf + client->sent,
+            client->len - client->sent,
+            MSG_NOSIGNAL | MSG_DONTWAIT
+        );
+        if (n < 0) {
+            return errno != EAGAIN && errno != EINTR;
+        }
+        client->sent += n;
+    }
+    return true;
+}
+
+/******************************************************************************
+ * @brief   Accept every connection to the metrics socket and send each its
+ *          report. A report that the socket does not take at once is sent
+ *          when epoll finds room for it. Connections beyond METRICS_CLIENTS
+ *          pending ones are closed right away.
+ * 
+ * @param efd       The epoll instance.
+ * @param running   The no. of children running.
+ * @param delayed   The no. of restarts backing off.
+ *****************************************************************************/
+void accept_metrics(int efd, size_t running, size_t delayed)
+{
+    int fd;
+    while ((fd = accept(metrics_fd, NULL, NULL)) != -1) {
+        struct metrics_client   client  = { fd, NULL, 0, 0 };
+        FILE*                   fptr;
+        struct epoll_event      ev;
+
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        if (nclients == METRICS_CLIENTS || (fptr = open_memstream(&client.buf, &client.len)) == NULL) {
+            close(fd);
+            continue;
+        }
+        write_metrics(fptr, running, delayed);
+        fclose(fptr);
+        ev.events   = EPOLLOUT;
+        ev.data.fd  = fd;
+        if (send_report(&client) || epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev)) {
+            close(fd);
+            free(client.buf);
+            continue;
+        }
+        clients[nclients++] = client;
+    }
+}
+
+/******************************************************************************
+ * @brief   Handle an event on the metrics socket or on one of its clients.
+ * 
+ * @param efd       The epoll instance.
+ * @param fd        The file descriptor of the event.
+ * @param running   The no. of children running.
+ * @param delayed   The no. of restarts backing off.
+ * 
+ * @return  True if the event was for the metrics socket or a client.
+ *****************************************************************************/
+bool metrics_event(int efd, int fd, size_t running, size_t delayed)
+{
+    if (fd == metrics_fd) {
+        accept_metrics(efd, running, delayed);
+        return true;
+    }
+    for (size_t i = 0; i < nclients; ++i) {
+        if (clients[i].fd == fd) {
+            if (send_report(&clients[i])) {
+                epoll_ctl(efd, EPOLL_CTL_DEL, fd, NULL);
+                close(fd);
+                free(clients[i].buf);
+                clients[i] = clients[--nclients];
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+/******************************************************************************
+ * @brief   Close the metrics socket and its clients, and remove its file.
+ *****************************************************************************/
+void close_metrics()
+{
+    for (size_t i = 0; i < nclients; ++i) {
+        close(clients[i].fd);
+        free(clients[i].buf);
+    }
+    nclients = 0;
+    if (metrics_fd != -1) {
+        close(metrics_fd);
+        unlink(metrics_path);
+    }
+}
+
+                /*******************************************/
+                /*                                         */
+                /*                Supervisor               */
+                /*                                         */
+                /*******************************************/
+
+sigset_t            oldmask;            /* Signal mask before SIGCHLD block. */
+int                 kill_timeout = 0;   /* Seconds before a child is killed. */
+size_t              running      = 0;   /* No. of children not reaped yet. */
+size_t              delayed      = 0;   /* No. of restarts in backoff. */
+const char*         usage_path   = NULL;    /* Where to write rusage. */
+const char*         journal_path = NULL;    /* Where to journal runs. */
+unsigned            journal_sync = JOURNAL_SYNC_MS; /* Least ms between syncs. */
+int                 epoll_fd     = -1;  /* Watches every event. */
+size_t              max_running  = 0;   /* Most children at once, 0 if any. */
+bool                load_aware   = false;   /* Hold launches under load. */
+
+/******************************************************************************
+ * @brief   The ways a child can be launched.
+ *****************************************************************************/
+enum backend {
+    BACKEND_FORK,               /* fork, redirect, then execvp */
+    BACKEND_SPAWN               /* posix_spawnp with file actions */
+};
+
+enum backend        launch_backend = BACKEND_FORK;  /* How to launch. */
+
+/******************************************************************************
+ * @brief   Launch a command with fork. The child redirects its stdout to its
+ *          output file before executing the command, or its stdout and stderr
+ *          to the capture pipes.
+ * 
+ * @param arglist   The arguments of the command, ending with NULL.
+ * @param cmdline   The command line.
+ * @param index     The line index of the command in the input file.
+ * @param generation    The no. of times the command was restarted before.
+ * @param capture       The pipe ends for its stdout and stderr, or NULL.
+ * 
+ * @return  The pid of the new child.
+ *****************************************************************************/
+int launch_fork(
+    char** arglist,
+    const char* cmdline,
+    size_t index,
+    unsigned generation,
+    const int* capture
+)
+{
+    int pid = fork();
+    /*
+    --  If fork error.
+    */
+    if (pid < 0) {
+        fprintf(stderr, "Fork Error!");
+        exit(2);
+    }
+    /*
+    --  If child process.
+    */
+    if (pid == 0) {
+        sigprocmask(SIG_SETMASK, &oldmask, NULL);
+        if (capture) {
+            dup2(capture[0], STDOUT_FILENO);
+            dup2(capture[1], STDERR_FILENO);
+            exec_command(index, arglist);
+        }
+        pid = getpid();
+        int fdout = redirect_to_file(pid, STDOUT_FILENO);
+        if (generation != 0) {
+            dprintf(fdout, RESTART_MSG);
+            dprintf(
+                fdout,
+                "Child %d of parent %d.\n"
+                "Restarting command `%s` at index %ld (restart #%u).\n\n",
+                pid,
+                getppid(),
+                cmdline,
+                index,
+                generation
+            );
+        }
+        // Execute the command.
+        exec_command(index, arglist);
+    }
+    return pid;
+}
+
+/******************************************************************************
+ * @brief   Launch a command with posix_spawnp, which does not copy the page
+ *          tables of the parent like fork does. The pid is unknown until the
+ *          child exists, so its stdout goes to a temporary file, which is then
+ *          renamed to the output file of the child. When capturing, its
+ *          stdout and stderr go to the capture pipes instead.
+ * 
+ * @param arglist   The arguments of the command, ending with NULL.
+ * @param cmdline   The command line.
+ * @param index     The line index of the command in the input file.
+ * @param generation    The no. of times the command was restarted before.
+ * @param fdout         Where to store the output file of the child, left
+ *                      open for the parent.
+ * @param capture       The pipe ends for its stdout and stderr, or NULL.
+ * 
+ * @return  The pid of the new child, or -1 if it could not be launched.
+ *****************************************************************************/
+int launch_spawn(
+    char** arglist,
+    const char* cmdline,
+    size_t index,
+    unsigned generation,
+    int* fdout,
+    const int* capture
+)
+{
+    extern char**               environ;
+    const char*                 path = commands[index].path;
+    posix_spawn_file_actions_t  actions;
+    posix_spawnattr_t           attr;
+    char                        tmpname[MAX_NUM_LINES];
+    char                        fout[MAX_NUM_LINES];
+    int                         pid;
+    int                         err;
+
+    if (capture) {
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, capture[0], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, capture[1], STDERR_FILENO);
+        posix_spawnattr_init(&attr);
+        posix_spawnattr_setsigmask(&attr, &oldmask);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+        err = path
+            ? posix_spawn(&pid, path, &actions, &attr, arglist, environ)
+            : posix_spawnp(&pid, arglist[0], &actions, &attr, arglist, environ);
+
+        posix_spawnattr_destroy(&attr);
+        posix_spawn_file_actions_destroy(&actions);
+        if (err != 0) {
+            fprintf(stderr, "Unable to launch `%s`: %s\n", cmdline, strerror(err));
+            return -1;
+        }
+        return pid;
+    }
+
+    sprintf(tmpname, ".spawn-%d.out", getpid());
+    *fdout = open(
+        tmpname,
+        O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+        S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH
+    );
+    if (*fdout == -1) {
+        perror("proc_manager");
+        return -1;
+    }
+    if (generation != 0) {
+        write(*fdout, RESTART_MSG, strlen(RESTART_MSG));
+    }
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, *fdout, STDOUT_FILENO);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &oldmask);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+    err = path
+        ? posix_spawn(&pid, path, &actions, &attr, arglist, environ)
+        : posix_spawnp(&pid, arglist[0], &actions, &attr, arglist, environ);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    if (err != 0) {
+        fprintf(stderr, "Unable to launch `%s`: %s\n", cmdline, strerror(err));
+        unlink(tmpname);
+        close(*fdout);
+        *fdout = -1;
+        return -1;
+    }
+
+    sprintf(fout, "%d.out", pid);
+    rename(tmpname, fout);
+    if (generation != 0) {
+        dprintf(
+            *fdout,
+            "Child %d of parent %d.\n"
+            "Restarting command `%s` at index %ld (restart #%u).\n\n",
+            pid,
+            getpid(),
+            cmdline,
+            index,
+            generation
+        );
+    }
+    return pid;
+}
+
+/******************************************************************************
+ * @brief   Launch a child to execute a command, and record it in the table.
+ * 
+ * @param command   The command line, which must be in the arena.
+ * @param index     The line index of the command in the input file.
+ * @param prev_pid  The pid of the run being restarted, 0 for a first run.
+ * 
+ * @return  The pid of the new child, or -1 if it could not be launched.
+ *****************************************************************************/
+int spawn_command(const char* command, size_t index, int prev_pid)
+{
+    struct command_stats* cs = &commands[index];
+
+    /*
+    --  Launch it, timing the run from right before the launch.
+    */
+    struct timespec starttime;
+    unsigned        generation  = command_generation(index);
+    int             fdout       = -1;
+    int             pid         = -1;
+    int             reads[2];
+    int             ends[2];
+    int*            capture     = NULL;
+    bool            from_pool   = false;
+    /*
+    --  A zygote of the pool is already forked and redirected: it only has to
+    --  execute the command.
+    */
+    if (pool_count > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &starttime);
+        pid         = launch_zygote(epoll_fd, index);
+        from_pool   = pid != -1;
+    }
+    if (!from_pool && capture_mode) {
+        if (!open_capture_pipes(reads, ends)) {
+            perror("proc_manager");
+            return -1;
+        }
+        watch_pipe(epoll_fd, reads[0], index, 0);
+        watch_pipe(epoll_fd, reads[1], index, 1);
+        capture = ends;
+    }
+    if (!from_pool) {
+        clock_gettime(CLOCK_MONOTONIC, &starttime);
+        pid = launch_backend == BACKEND_SPAWN && !cs->limited
+            ? launch_spawn(cs->argv, command, index, generation, &fdout, capture)
+            : launch_fork(cs->argv, command, index, generation, capture);
+    }
+    /*
+    --  Only the child writes to the pipes: once it exits, they reach their
+    --  end. If there is no child, they reach it right away.
+    */
+    if (capture) {
+        close(ends[0]);
+        close(ends[1]);
+    }
+    if (pid == -1) {
+        return -1;
+    }
+    /* 
+    --  Record the new child, keeping its output file open for its lifetime.
+    */
+    struct nlist* nentry = insert(pid, command, index, starttime);
+    if (nentry == NULL) {
+        fprintf(stderr, "Unable to record child %d\n", pid);
+        if (fdout != -1) {
+            close(fdout);
+        }
+    }
+    else {
+        nentry->generation  = generation;
+        nentry->fdout       = fdout;
+        if (prev_pid == 0) {
+            dprintf(
+                child_file(nentry, STDOUT_FILENO),
+                "Child %d of parent %d.\n"
+                "Starting command `%s` at index %ld.\n\n",
+                pid,
+                getpid(),
+                command,
+                index
+            );
+        }
+        else if (capture_mode || from_pool) {
+            fdout = child_file(nentry, STDOUT_FILENO);
+            dprintf(fdout, RESTART_MSG);
+            dprintf(
+                fdout,
+                "Child %d of parent %d.\n"
+                "Restarting command `%s` at index %ld (restart #%u).\n\n",
+                pid,
+                getpid(),
+                command,
+                index,
+                generation
+            );
+        }
+    }
+    if (nentry != NULL && kill_timeout > 0) {
+        nentry->deadline = monotonic_ns() + kill_timeout * 1000000000ULL;
+        deadline_push(nentry->deadline, DEADLINE_KILL, pid, index);
+    }
+    if (nentry != NULL) {
+        running++;                  // handle_exit only counts known children
+    }
+    record_launch();
+    journal_append(JOURNAL_LAUNCH, index, cs->hash, generation, pid, 0);
+    return pid;
+}
+
+/******************************************************************************
+ * @brief   Mark a command as succeeded, and queue the commands that were only
+ *          waiting for it.
+ * 
+ * @param index     The line index of the command in the input file.
+ *****************************************************************************/
+void release_dependents(size_t index)
+{
+    struct command_stats* cs = &commands[index];
+    if (cs->succeeded) {
+        return;
+    }
+    cs->succeeded = true;
+    for (size_t d = 0; d < cs->ndependents; ++d) {
+        struct command_stats* dep = &commands[cs->dependents[d]];
+        if (--dep->waiting == 0 && !dep->cancelled && !dep->done) {
+            enqueue(dep->command, cs->dependents[d], 0);
+        }
+    }
+}
+
+/******************************************************************************
+ * @brief   Cancel every command waiting for a command that will not succeed,
+ *          and the commands waiting for those, and so on.
+ * 
+ * @param index     The line index of the command that will not succeed.
+ *****************************************************************************/
+void cancel_dependents(size_t index)
+{
+    struct command_stats* cs = &commands[index];
+    if (cs->succeeded) {
+        return;
+    }
+    for (size_t d = 0; d < cs->ndependents; ++d) {
+        struct command_stats* dep = &commands[cs->dependents[d]];
+        if (dep->cancelled || dep->done) {
+            continue;
+        }
+        dep->cancelled = true;
+        journal_append(JOURNAL_DONE, cs->dependents[d], dep->hash, 0, 0, 0);
+        printf(
+            "Cancelled command `%s` at index %ld: `%s` did not succeed.\n",
+            dep->command,
+            cs->dependents[d],
+            cs->command
+        );
+        cancel_dependents(cs->dependents[d]);
+    }
+}
+
+/******************************************************************************
+ * @brief   Replay a record of the journal into the stats of its command. A
+ *          record about a line that now holds another command is ignored.
+ * 
+ * @param r         The record.
+ * @param arg       Unused.
+ *****************************************************************************/
+void replay_record(const struct journal_record* r, void* arg)
+{
+    if (r->index >= commands_count) {
+        return;
+    }
+    struct command_stats* cs = &commands[r->index];
+    if (cs->command == NULL || cs->hash != r->hash) {
+        return;
+    }
+    switch (r->type) {
+    case JOURNAL_LAUNCH:
+        if (cs->launches <= r->generation) {
+            cs->launches = r->generation + 1;   // keep numbering restarts
+        }
+        break;
+    case JOURNAL_EXIT:
+        if (WIFEXITED(r->status) && WEXITSTATUS(r->status) == 0) {
+            cs->crashes     = 0;
+            cs->succeeded   = true;     // even if it was restarted since
+        }
+        else {
+            cs->crashes++;
+        }
+        break;
+    case JOURNAL_DONE:
+        cs->done        = true;
+        cs->succeeded   = cs->succeeded || r->status == 1;
+        break;
+    }
+}
+
+/******************************************************************************
+ * @brief   Let the commands that ran before count as such: the commands
+ *          waiting for one that succeeded, even if it was restarted since,
+ *          wait for one less, and those waiting for one finished without
+ *          succeeding are cancelled, if not already.
+ * 
+ * @return  The no. of commands finished before.
+ *****************************************************************************/
+size_t resume_commands()
+{
+    size_t done = 0;
+    for (size_t i = 0; i < commands_count; ++i) {
+        struct command_stats* cs = &commands[i];
+        if (cs->command == NULL) {
+            continue;
+        }
+        done += cs->done;
+        if (cs->succeeded) {
+            for (size_t d = 0; d < cs->ndependents; ++d) {
+                commands[cs->dependents[d]].waiting--;
+            }
+        }
+        else if (cs->done) {
+            cancel_dependents(i);
+        }
+    }
+    return done;
+}
+
+/******************************************************************************
+ * @brief   Restart a command after its backoff delay, unless its policy says
+ *          it has been restarted enough or it keeps crashing.
+ * 
+ * @param index     The line index of the command in the input file.
+ * @param pid       The pid of the run that exceeded the limit time.
+ * @param out       The message to the output file of that run, to tell what
+ *                  happens.
+ * 
+ * @return  True if the command will be restarted.
+ *****************************************************************************/
+bool restart_command(size_t index, int pid, struct child_msg* out)
+{
+    struct command_stats*   cs          = &commands[index];
+    unsigned                restarts    = cs->launches - 1;
+
+    /*
+    --  Park a command crashing in a loop.
+    */
+    if (cs->policy.crash_limit > 0 && cs->crashes >= cs->policy.crash_limit) {
+        cs->parked = true;
+        msg_printf(out, PARKED_MSG, cs->crashes);
+        printf(
+            "Parked command `%s` at index %ld after %u crashes in a row.\n",
+            cs->command,
+            index,
+            cs->crashes
+        );
+        return false;
+    }
+    if (cs->policy.max_restarts >= 0 && restarts >= (unsigned)cs->policy.max_restarts) {
+        msg_printf(out, MAX_RESTARTS_MSG, cs->policy.max_restarts);
+        return false;
+    }
+    msg_puts(out, EXCEED_TIME_MSG);
+
+    /*
+    --  Back off exponentially, with a random half of the delay taken off so
+    --  that commands started together do not restart together.
+    */
+    double delay = cs->policy.backoff;
+    for (unsigned i = 0; i < restarts && delay < BACKOFF_CAP; ++i) {
+        delay *= 2;
+    }
+    if (delay > BACKOFF_CAP) {
+        delay = BACKOFF_CAP;
+    }
+    delay *= 0.5 + 0.5 * random() / RAND_MAX;
+    if (delay > 0) {
+        msg_printf(out, BACKOFF_MSG, delay);
+        uint64_t when = monotonic_ns() + (uint64_t)(delay * PRECISION);
+        if (deadline_push(when, DEADLINE_RESTART, pid, index)) {
+            delayed++;
+            return true;
+        }
+    }
+    enqueue(cs->command, index, pid);
+    return true;
+}
+
+/******************************************************************************
+ * @brief   Record the exit of a child, and restart its command if it ran for
+ *          longer than the time threshold.
+ * 
+ * @param pid       The pid of the child.
+ * @param status    The wait status of the child.
+ * @param usage     The resources used by the child.
+ *****************************************************************************/
+void handle_exit(int pid, int status, const struct rusage* usage)
+{
+    struct nlist*       entry = lookup(pid);
+    struct timespec     endtime;
+    double              elapsed;
+    struct child_msg    out;
+    struct child_msg    err;
+
+    if (entry == NULL) {
+        return;
+    }
+    running--;
+    entry->running  = false;
+    out.count       = err.count = 0;
+    out.used        = err.used  = 0;
+
+    /*
+    --  If normal exit.
+    */
+    if (WIFEXITED(status)) {
+        msg_printf(
+            &err,
+            "Child %d exits normally with code %d\n",
+            pid,
+            WEXITSTATUS(status)
+        );
+    }
+    /*
+    --  If abnormal termination.
+    */
+    else if (WIFSIGNALED(status)) {
+        msg_printf(
+            &err,
+            "Child %d terminated abnormally with signal number %d\n",
+            pid,
+            WTERMSIG(status)
+        );
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &endtime);
+    elapsed = get_elapsed_time(entry->starttime, endtime);
+    record_latency(entry->index, elapsed);
+    record_usage(entry->index, usage);
+
+    /*
+    --  Count the crashes in a row: any run that was killed or failed.
+    */
+    struct command_stats*   cs          = &commands[entry->index];
+    bool                    succeeded   = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    bool                    restarted   = false;
+    if (succeeded) {
+        cs->crashes = 0;
+        release_dependents(entry->index);
+    }
+    else {
+        cs->crashes++;
+    }
+
+    /*
+    --  If 2 seconds have elapsed:
+    --  Restart the command in a new process, as its policy allows.
+    */
+    if (elapsed > TIME_THRESHOLD) {
+        restarted = restart_command(entry->index, pid, &out);
+    }
+    /*
+    --  If command finished within 2 seconds:
+    --  Print the in time message to file and exit.
+    */
+    else {
+        msg_puts(&err, IN_TIME_MSG);
+        msg_printf(
+            &out,
+            "\nStarted at: %ld\nFinished at: %ld\nElapsed time: %fs",
+            entry->starttime.tv_sec,
+            endtime.tv_sec,
+            elapsed
+        );
+    }
+
+    /*
+    --  A command that is over without ever succeeding lets down the commands
+    --  waiting for it.
+    */
+    journal_append(JOURNAL_EXIT, entry->index, cs->hash, entry->generation, pid, status);
+    if (restarted) {
+        journal_append(JOURNAL_RESTART, entry->index, cs->hash, cs->launches, pid, 0);
+    }
+    else {
+        journal_append(JOURNAL_DONE, entry->index, cs->hash, 0, pid, cs->succeeded);
+        cancel_dependents(entry->index);
+    }
+
+    /*
+    --  Write everything with one writev per file, and close them for good.
+    */
+    msg_flush(&err, child_file(entry, STDERR_FILENO));
+    msg_flush(&out, child_file(entry, STDOUT_FILENO));
+    close_child_files(entry);
+    remove_pid(pid);
+}
+
+/******************************************************************************
+ * @brief   Launch queued commands until the queue is empty, the maximum number
+ *          of running children is reached or, in load aware mode, the machine
+ *          is busy. At least one child is always kept running so the queue
+ *          keeps moving.
+ *****************************************************************************/
+void dispatch()
+{
+    while (queue_count > 0) {
+        if (max_running > 0 && running >= max_running) {
+            break;
+        }
+        if (load_aware && running > 0 && overloaded()) {
+            break;
+        }
+        struct job job;
+        dequeue(&job);
+        if (spawn_command(job.command, job.index, job.prev_pid) == -1) {
+            journal_append(JOURNAL_DONE, job.index, commands[job.index].hash, 0, 0, 0);
+            cancel_dependents(job.index);
+        }
+    }
+}
+
+/******************************************************************************
+ * @brief   Reap every child that has exited, without blocking. wait4 gives
+ *          the resources each one used with no extra system call.
+ * 
+ * @param woke      When the supervisor was woken up to reap them.
+ *****************************************************************************/
+void reap_children(uint64_t woke)
+{
+    struct rusage   usage;
+    int             status;
+    int             pid;
+    while ((pid = wait4(-1, &status, WNOHANG, &usage)) > 0) {
+        if (zygote_reaped(pid)) {
+            continue;
+        }
+        handle_exit(pid, status, &usage);
+        record_reap(monotonic_ns() - woke);
+    }
+}
+
+/******************************************************************************
+ * @brief   Kill every running child whose deadline has passed, which is then
+ *          reaped like any other child, and queue every command whose restart
+ *          backoff is over.
+ *****************************************************************************/
+void expire_deadlines()
+{
+    uint64_t now = monotonic_ns();
+    while (dheap_count > 0 && dheap[0].when <= now) {
+        struct deadline d       = deadline_pop();
+        struct nlist*   entry   = lookup(d.pid);
+        /*
+        --  Queue the commands done backing off.
+        */
+        if (d.kind == DEADLINE_RESTART) {
+            delayed--;
+            enqueue(commands[d.index].command, d.index, d.pid);
+            continue;
+        }
+        /*
+        --  Skip the deadlines of children that already exited.
+        */
+        if (entry == NULL || !entry->running || entry->deadline != d.when) {
+            continue;
+        }
+        dprintf(child_file(entry, STDOUT_FILENO), KILLED_MSG, kill_timeout);
+        kill(d.pid, SIGKILL);
+    }
+}
+
+                /*******************************************/
+                /*                                         */
+                /*                  M A I N                */
+                /*                                         */
+                /*******************************************/
+
+int main(int argc, char** argv)
+{
+    int opt;
+    /*
+    --  Read the options.
+    */
+    while ((opt = getopt(argc, argv, "k:s:j:lr:b:c:u:oR:t:m:J:F:")) != -1) {
+        switch (opt) {
+        case 'J':
+            journal_path = optarg;
+            break;
+        case 'F':
+            journal_sync = atoi(optarg);
+            break;
+        case 'm':
+            metrics_path = optarg;
+            break;
+        case 't':
+            template_mode   = true;
+            pool_size       = atoi(optarg);
+            break;
+        case 'o':
+            capture_mode = true;
+            break;
+        case 'R':
+            rotate_size = parse_size(optarg);
+            break;
+        case 'u':
+            usage_path = optarg;
+            break;
+        case 'r':
+            default_policy.max_restarts = atoi(optarg);
+            break;
+        case 'b':
+            default_policy.backoff = atof(optarg);
+            break;
+        case 'c':
+            default_policy.crash_limit = atoi(optarg);
+            break;
+        case 'k':
+            kill_timeout = atoi(optarg);
+            break;
+        case 'j':
+            max_running = atoi(optarg) > 0 ? atoi(optarg) : 0;
+            break;
+        case 'l':
+            load_aware = true;
+            break;
+        case 's':
+            if (strcmp(optarg, "spawn") == 0) {
+                launch_backend = BACKEND_SPAWN;
+            }
+            else if (strcmp(optarg, "fork") != 0) {
+                validate_input(0, NULL);
+            }
+            break;
+        default:
+            validate_input(0, NULL);
+        }
+    }
+    /*
+    --  Validate input arguments, ignoring the program name and options.
+    */
+    argc -= optind;
+    argv += optind;
+    validate_input(argc, argv);
+
+    printf("Reading from \"%s\"...\n", *argv);
+    srandom(getpid() ^ time(NULL));
+    raise_file_limit();
+
+    char                line[MAX_NUM_LINES];        // A line in the file.
+    FILE*               fptr = fopen(*argv, "r");   // The text file.
+    sigset_t            mask;                       // Signals to be blocked.
+    struct epoll_event  ev;                         // Event to be watched.
+    struct epoll_event  events[MAX_EVENTS];         // Events received.
+
+    if (fptr == NULL) {
+        printf(CONSOLE_ERROR, "Error: Unable to open the given file\n");
+        exit(1);
+    }
+
+    /*
+    --  Block SIGCHLD before the first fork, so that no exit is missed.
+    --  It is delivered through a signalfd, watched with the timerfd of the
+    --  deadlines by epoll.
+    */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &oldmask);
+    int sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (sfd == -1 || tfd == -1 || epoll_fd == -1) {
+        perror("proc_manager");
+        exit(2);
+    }
+    /*
+    --  A zygote that dies before it is given a command must not kill the
+    --  supervisor with SIGPIPE. The children get the mask from before.
+    */
+    if (pool_size > 0) {
+        sigset_t pipes;
+        sigemptyset(&pipes);
+        sigaddset(&pipes, SIGPIPE);
+        sigprocmask(SIG_BLOCK, &pipes, NULL);
+    }
+    ev.events   = EPOLLIN;
+    ev.data.fd  = sfd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sfd, &ev);
+    ev.data.fd  = tfd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, tfd, &ev);
+    if (metrics_path && !open_metrics(epoll_fd, metrics_path)) {
+        perror("proc_manager: metrics socket");
+        exit(2);
+    }
+
+    /*
+    --  The first loop.
+    --  Read the commands in the text file, with their attributes.
+    --  Each one is put into the hash table, which is used for recording each
+    --  exec, once it is launched.
+    */
+    for (size_t i = 0; fgets(line, MAX_NUM_LINES, fptr); ++i) {
+        trim_newline(line);
+        struct command_spec spec    = { default_policy, NULL, NULL, DEFAULT_COST, { 0 } };
+        char*               start   = line;
+        if (!parse_attributes(&start, &spec)) {
+            printf(CONSOLE_ERROR, "Error: Invalid attributes on line ");
+            printf("%ld, skipped.\n", i + 1);
+            continue;
+        }
+        /*
+        --  Split it into its arguments once, for every launch to reuse.
+        */
+        char** arglist = tokenize_command(start);
+        if (arglist == NULL) {
+            printf(CONSOLE_ERROR, "Error: Unclosed quote on line ");
+            printf("%ld, skipped.\n", i + 1);
+            continue;
+        }
+        const char* command = arglist[0] ? arena_strdup(start) : NULL;
+        if (command == NULL || !add_command(i, command, arglist, &spec)) {
+            free(arglist);              // empty line, or out of memory
+        }
+    }
+
+    /*
+    --  Queue the commands that do not wait for others, the ones starting the
+    --  longest chains first.
+    */
+    if (!resolve_dependencies()) {
+        exit(1);
+    }
+    /*
+    --  Replay the journal, to launch only what was not finished before.
+    */
+    if (journal_path) {
+        long records = journal_open(journal_path, journal_sync, replay_record, NULL);
+        if (records == -1) {
+            printf(CONSOLE_ERROR, "Error: Unable to use the journal ");
+            printf("\"%s\".\n", journal_path);
+            exit(1);
+        }
+        if (records > 0) {
+            printf(
+                "Resuming from \"%s\": %ld records, %ld commands finished.\n",
+                journal_path,
+                records,
+                resume_commands()
+            );
+        }
+    }
+    /*
+    --  Give the commands with memory or cpumax limits their cgroups.
+    */
+    setup_limits();
+    if (template_mode) {
+        resolve_paths();
+        fill_pool(&oldmask);
+    }
+    for (size_t i = 0; i < commands_count; ++i) {
+        if (commands[i].command && commands[i].waiting == 0
+            && !commands[i].done && !commands[i].cancelled) {
+            enqueue(commands[i].command, i, 0);
+        }
+    }
+    dispatch();
+    arm_timer(tfd);
+
+    /*
+    --  The second loop.
+    --  Wait for events until everything is finished: children exiting, and
+    --  deadlines passing. Every exit frees a slot for the queued commands.
+    --  While launches are held back by the load, check it again shortly.
+    --  Captured output is read as it comes, and buffered output is written
+    --  at the latest a second after it came. Metrics are served in between,
+    --  without ever waiting for a client.
+    --  When there is no more child process, the parent process will exit.
+    */
+    reap_children(monotonic_ns());
+    dispatch();
+    while (running > 0 || queue_count > 0 || delayed > 0 || open_pipes > 0) {
+        bool held   = queue_count > 0
+                   && (max_running == 0 || running < max_running);
+        int  wait   = held ? LOAD_POLL_MS : dirty_count ? CAPTURE_FLUSH_MS : -1;
+        int  nev    = epoll_wait(epoll_fd, events, MAX_EVENTS, journal_timeout(wait));
+        uint64_t woke = monotonic_ns();
+        if (nev < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("proc_manager");
+            break;
+        }
+        for (int e = 0; e < nev; ++e) {
+            if (events[e].data.fd == sfd) {
+                struct signalfd_siginfo info;
+                while (read(sfd, &info, sizeof(info)) == sizeof(info));
+                reap_children(woke);
+            }
+            else if (events[e].data.fd == tfd) {
+                uint64_t expirations;
+                read(tfd, &expirations, sizeof(expirations));
+                expire_deadlines();
+            }
+            else if (!metrics_event(epoll_fd, events[e].data.fd, running, delayed)) {
+                read_pipe(epoll_fd, events[e].data.fd);
+            }
+        }
+        flush_captures(false);
+        dispatch();
+        if (queue_count > 0 || delayed > 0 || running > 0) {
+            fill_pool(&oldmask);
+        }
+        journal_tick();
+        arm_timer(tfd);
+    }
+
+    print_latency_summary();
+    if (usage_path) {
+        write_usage_summary(usage_path);
+    }
 
     /*
     --  Perform the exit protocols
     */
+    retire_pool();
+    journal_close();
+    close_metrics();
+    remove_cgroups();
+    close_captures();
+    close(epoll_fd);
+    close(tfd);
+    close(sfd);
     fclose(fptr);                                       // Close text file.
-    free_htable();                                      // Free hash table.
+    free_queue();                                       // Free job queue.
+    free_htable();                                      // Free pid table.
+    free_commands();                                    // Free the stats.
+    free(dheap);                                        // Free the deadlines.
     return EXIT_SUCCESS;                                // Exit with code 0.
 }
@@ -0,0 +1,138 @@
+/******************************************************************************
+ *
+ * @file        bench_msum.c
+ *
+ * @author      Luan Truong
+ *
+ * @brief       A benchmark of the ways summatrix_threaded can accumulate the
+ *              matrix sum: padded per-worker partial sums reduced at join,
+ *              the same partial sums packed next to each other, and one
+ *              shared sum updated with an atomic fetch_add.
+ *
+ * @date        2022-04-28
+ *
+ * @copyright   Copyright (c) 2022
+ *
+ *****************************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define CACHE_LINE  64              /* Size of a cache line in bytes. */
+#define ADDS        20000000UL      /* No. of additions done by each worker. */
+#define MIN_THREADS 8               /* Go up to at least this many threads. */
+
+/*---------------------------------------------------------------------------*/
+/* PARTIAL                          A running sum owning a whole cache line. */
+/*---------------------------------------------------------------------------*/
+typedef struct PARTIAL {
+    unsigned long   sum;
+    char            pad[CACHE_LINE - sizeof(unsigned long)];
+} __attribute__((aligned(CACHE_LINE))) PARTIAL;
+
+/*---------------------------------------------------------------------------*/
+/* WORKER                           What one benchmark worker adds into.     */
+/*---------------------------------------------------------------------------*/
+typedef struct WORKER {
+    volatile unsigned long* target; /* Where the additions go. */
+    int                     atomic; /* Use fetch_add on the target. */
+} WORKER;
+
+/*---------------------------------------------------------------------------*/
+/* add_numbers                      The routine of every benchmark worker.   */
+/*---------------------------------------------------------------------------*/
+void* add_numbers(arg)
+
+    void*       arg;                /* The WORKER of this thread. */
+
+{
+    WORKER*     w = (WORKER*)arg;
+
+    if (w->atomic) {
+        for (unsigned long i = 0; i < ADDS; ++i) {
+            __atomic_fetch_add(w->target, i & 0xFF, __ATOMIC_RELAXED);
+        }
+    }
+    else {
+        for (unsigned long i = 0; i < ADDS; ++i) {
+            *w->target += i & 0xFF;
+        }
+    }
+    return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+/* run                              Run `nthreads` workers in one mode and   */
+/*                                  return the additions per second.         */
+/*---------------------------------------------------------------------------*/
+double run(mode, nthreads)
+
+    const char* mode;               /* "padded", "packed" or "atomic". */
+    size_t      nthreads;           /* No. of workers. */
+
+{
+    pthread_t           tids[nthreads];
+    WORKER              workers[nthreads];
+    PARTIAL*            padded  = aligned_alloc(CACHE_LINE, nthreads * sizeof(PARTIAL));
+    unsigned long       packed[nthreads] __attribute__((aligned(CACHE_LINE)));
+    unsigned long       shared  = 0;
+    struct timespec     start, end;
+
+    memset(padded, 0, nthreads * sizeof(PARTIAL));
+    memset(packed, 0, sizeof(packed));
+    for (size_t i = 0; i < nthreads; ++i) {
+        workers[i].atomic = (strcmp(mode, "atomic") == 0);
+        if (workers[i].atomic) {
+            workers[i].target = &shared;
+        }
+        else if (strcmp(mode, "packed") == 0) {
+            workers[i].target = &packed[i];
+        }
+        else {
+            workers[i].target = &padded[i].sum;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < nthreads; ++i) {
+        pthread_create(&tids[i], NULL, add_numbers, &workers[i]);
+    }
+    for (size_t i = 0; i < nthreads; ++i) {
+        pthread_join(tids[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    free(padded);
+    double elapsed = (end.tv_sec - start.tv_sec)
+                   + (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+    return (double)ADDS * nthreads / elapsed;
+}
+
+                /**********************************/
+                /*                                */
+                /*             M A I N            */
+                /*                                */
+                /**********************************/
+
+int main()
+{
+    long        ncores  = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t      maxthr  = ncores < MIN_THREADS ? MIN_THREADS : (size_t)ncores;
+
+    printf("%d cores online, %lu additions per thread\n\n", (int)ncores, ADDS);
+    printf("%8s %16s %16s %16s\n", "threads", "padded Madd/s", "packed Madd/s",
+           "atomic Madd/s");
+    for (size_t t = 1; t <= maxthr; t *= 2) {
+        printf(
+            "%8lu %16.1f %16.1f %16.1f\n",
+            t,
+            run("padded", t) / 1e6,
+            run("packed", t) / 1e6,
+            run("atomic", t) / 1e6
+        );
+    }
+    return EXIT_SUCCESS;
+}
@@ -17,8 +17,21 @@
 #include <string.h>
 #include <ctype.h>
 #include <pthread.h>
+#include <stdarg.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-#define FILES_NO    3               /* Number of input files. */
+#define CHUNK_FLAG  "-c"            /* Flag to split each file across cores. */
+#define ATOMIC_FLAG "-a"            /* Flag to add into msum as we go. */
+#define CACHE_LINE  64              /* Size of a cache line in bytes. */
+#define LOG_LINE    256             /* Max length of one log message. */
+#define LOG_SLOTS   512             /* Messages a thread can have queued. */
+#define LOG_BATCH   65536           /* Size of the flusher's output buffer. */
+#define LOG_IDLE_NS 1000000         /* Flusher nap when there is no message. */
 #define ERR_COLOR   "\033[1;31m"    /* Console color for error messages. */
 #define WARN_COLOR  "\033[1;33m"    /* Console color for warning messages. */
 #define SUCC_COLOR  "\033[0;32m"    /* Console color for success messages. */
@@ -33,33 +46,275 @@ typedef struct THREADDATA {
     pthread_t   creator;
 } THREADDATA;
 
+/*---------------------------------------------------------------------------*/
+/* PARTIAL                          The running sum of one worker. Each one  */
+/*                                  owns a whole cache line, so no worker    */
+/*                                  writes to a line another worker reads.   */
+/*---------------------------------------------------------------------------*/
+typedef struct PARTIAL {
+    unsigned long   sum;            /* Sum of the numbers read so far. */
+    char            pad[CACHE_LINE - sizeof(unsigned long)];
+} __attribute__((aligned(CACHE_LINE))) PARTIAL;
+
+/*---------------------------------------------------------------------------*/
+/* WORKQUEUE                        The list of files waiting to be summed.  */
+/*                                  The pool workers take files off it one   */
+/*                                  at a time until it runs dry.             */
+/*---------------------------------------------------------------------------*/
+typedef struct WORKQUEUE {
+    char**          files;          /* Files to be summed. */
+    size_t          count;          /* No. of files. */
+    size_t          next;           /* Index of the next file to hand out. */
+    pthread_mutex_t lock;           /* Guards `next`. */
+} WORKQUEUE;
+
+/*---------------------------------------------------------------------------*/
+/* CHUNK                            A byte range of a mapped file, aligned   */
+/*                                  to whole lines, that is summed by its    */
+/*                                  own thread.                              */
+/*---------------------------------------------------------------------------*/
+typedef struct CHUNK {
+    const char*     data;           /* The mapped file. */
+    const char*     filepath;       /* Path to the file, for warnings. */
+    size_t          t_idx;          /* Index of the thread of this chunk. */
+    size_t          begin;          /* Offset of the first byte in range. */
+    size_t          end;            /* Offset right after the last byte. */
+    size_t          rows;           /* No. of newlines inside the range. */
+    size_t          first_row;      /* Row number of the range's first line. */
+    unsigned long   sum;            /* The sum calculated over the range. */
+} CHUNK;
+
 /*---------------------------------------------------------------------------*/
 /* Global variables                                                          */
 /*---------------------------------------------------------------------------*/
 bool                efound  = false;    /* Flag if an error is encountered. */
+bool                chunked = false;    /* Split each file across cores. */
+bool                atomic  = false;    /* Keep msum up to date as we go. */
 unsigned long       msum    = 0;        /* The result matrix sum. */
+PARTIAL*            partials;           /* Running sums, one per worker. */
 size_t              n;                  /* Number of columns to read up to. */
-char*               files[FILES_NO];    /* List of files to be read. */
-pthread_t           tids[FILES_NO];     /* IDs of the threads. */
-pthread_mutex_t     locks[FILES_NO];    /* Thread locks. */
-pthread_mutex_t     lock;               /* Used to lock a block of code. */
+char**              files;              /* List of files to be read. */
+size_t              nfiles;             /* No. of files to be read. */
+pthread_t*          tids;               /* IDs of the pool workers. */
+size_t              nworkers;           /* No. of pool workers. */
+WORKQUEUE           queue;              /* Files not yet taken by a worker. */
+pthread_mutex_t     plock;              /* Guards the THREADDATA. */
 THREADDATA*         p;
 
 /*---------------------------------------------------------------------------*/
-/* pre_print_protocols              Performs the protocols needed before     */
-/*                                  printing something to the console. This  */
-/*                                  includes printing the log index and the  */
-/*                                  current date time.                       */
+/* LOGLINE                          One formatted message waiting to be      */
+/*                                  printed.                                 */
+/*---------------------------------------------------------------------------*/
+typedef struct LOGLINE {
+    unsigned short  len;            /* Length of the message. */
+    char            text[LOG_LINE]; /* The message, not NUL terminated. */
+} LOGLINE;
+
+/*---------------------------------------------------------------------------*/
+/* LOGRING                          The log buffer of one thread. Only its   */
+/*                                  owner moves `head` and only the flusher  */
+/*                                  moves `tail`, so no lock is needed.      */
+/*---------------------------------------------------------------------------*/
+typedef struct LOGRING {
+    size_t          head;           /* Next slot the owner writes. */
+    char            hpad[CACHE_LINE - sizeof(size_t)];
+    size_t          tail;           /* Next slot the flusher reads. */
+    char            tpad[CACHE_LINE - sizeof(size_t)];
+    int             in_use;         /* Whether a live thread owns the ring. */
+    struct LOGRING* next;           /* Next ring in the registry. */
+    LOGLINE         lines[LOG_SLOTS];
+} __attribute__((aligned(CACHE_LINE))) LOGRING;
+
+LOGRING*            log_rings   = NULL;     /* Registry of every log ring. */
+__thread LOGRING*   log_ring    = NULL;     /* Log ring of this thread. */
+pthread_key_t       log_key;                /* Releases a ring at thread exit. */
+pthread_t           log_tid;                /* The flusher thread. */
+bool                log_running = false;    /* Whether the flusher started. */
+int                 log_stop    = 0;        /* Asks the flusher to finish. */
+
+/*---------------------------------------------------------------------------*/
+/* log_release_ring                 Give the ring of an exiting thread back, */
+/*                                  so that a later thread can reuse it.     */
+/*---------------------------------------------------------------------------*/
+void log_release_ring(arg)
+
+    void*       arg;                /* The ring of the exiting thread. */
+
+{
+    __atomic_store_n(&((LOGRING*)arg)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/*---------------------------------------------------------------------------*/
+/* log_claim_ring                   Get a ring for the calling thread. Reuse */
+/*                                  a ring left by an exited thread if there */
+/*                                  is one, otherwise register a new one.    */
 /*---------------------------------------------------------------------------*/
-void pre_print_protocols()
+LOGRING* log_claim_ring()
+{
+    LOGRING*    ring;
+
+    for (ring = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE);
+         ring != NULL;
+         ring = ring->next) {
+        int free_ring = 0;
+        if (__atomic_compare_exchange_n(&ring->in_use, &free_ring, 1, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (ring == NULL) {
+        ring = (LOGRING*)aligned_alloc(CACHE_LINE, sizeof(LOGRING));
+        if (ring == NULL) {
+            return NULL;
+        }
+        ring->head      = 0;
+        ring->tail      = 0;
+        ring->in_use    = 1;
+        ring->next      = __atomic_load_n(&log_rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&log_rings, &ring->next, ring,
+                                            false, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED));
+    }
+    pthread_setspecific(log_key, ring);
+    return ring;
+}
+
+/*---------------------------------------------------------------------------*/
+/* log_printf                       Queue one whole log message. This is the */
+/*                                  only work done by the logging thread;    */
+/*                                  the log index and date time are added    */
+/*                                  later by the flusher.                    */
+/*---------------------------------------------------------------------------*/
+void log_printf(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+
+void log_printf(const char* fmt, ...)
+{
+    va_list     args;
+
+    if (log_ring == NULL && (log_ring = log_claim_ring()) == NULL) {
+        return;
+    }
+    /*
+    --  Wait for the flusher if the ring is full.
+    */
+    size_t head = log_ring->head;
+    while (head - __atomic_load_n(&log_ring->tail, __ATOMIC_ACQUIRE)
+           >= LOG_SLOTS) {
+        sched_yield();
+    }
+    LOGLINE* line = &log_ring->lines[head % LOG_SLOTS];
+    va_start(args, fmt);
+    int len = vsnprintf(line->text, LOG_LINE, fmt, args);
+    va_end(args);
+    if (len < 0) {
+        len = 0;
+    }
+    if (len >= LOG_LINE) {
+        len = LOG_LINE - 1;         /* Cut, but keep the line whole. */
+        line->text[len - 1] = '\n';
+    }
+    line->len = len;
+    __atomic_store_n(&log_ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*---------------------------------------------------------------------------*/
+/* log_drain                        Print every queued message in one batch, */
+/*                                  with the date time formatted once for    */
+/*                                  the whole batch. Return the no. of       */
+/*                                  messages printed.                        */
+/*---------------------------------------------------------------------------*/
+size_t log_drain()
 {
-    // Lock to avoid many threads interrupting the code.
-    pthread_mutex_lock(&lock);
     static size_t   log_idx = 0;
+    static char     batch[LOG_BATCH];
+    size_t          used    = 0;
+    size_t          printed = 0;
+    char            stamp[32];
     time_t          t;
+
     time(&t);
-    printf("Log #%ld at %s   >> ", ++log_idx, ctime(&t));
-    pthread_mutex_unlock(&lock);
+    ctime_r(&t, stamp);
+    for (LOGRING* ring = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE);
+         ring != NULL;
+         ring = ring->next) {
+        size_t tail = ring->tail;
+        size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        for (; tail != head; ++tail) {
+            LOGLINE* line = &ring->lines[tail % LOG_SLOTS];
+            if (used + LOG_LINE + 64 > LOG_BATCH) {
+                fwrite(batch, 1, used, stdout);
+                used = 0;
+            }
+            used += sprintf(batch + used, "Log #%ld at %s   >> ", ++log_idx, stamp);
+            memcpy(batch + used, line->text, line->len);
+            used += line->len;
+            printed++;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+    if (used > 0) {
+        fwrite(batch, 1, used, stdout);
+        fflush(stdout);
+    }
+    return printed;
+}
+
+/*---------------------------------------------------------------------------*/
+/* log_flusher                      The routine of the flusher thread. Keep  */
+/*                                  printing batches until asked to stop and */
+/*                                  nothing is left.                         */
+/*---------------------------------------------------------------------------*/
+void* log_flusher(arg)
+
+    void*       arg;                /* Unused. */
+
+{
+    struct timespec nap = { 0, LOG_IDLE_NS };
+
+    for (;;) {
+        int stop = __atomic_load_n(&log_stop, __ATOMIC_ACQUIRE);
+        if (log_drain() == 0) {
+            if (stop) {
+                break;
+            }
+            nanosleep(&nap, NULL);
+        }
+    }
+    return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+/* log_shutdown                     Stop the flusher once every message is   */
+/*                                  printed. Runs at exit.                   */
+/*---------------------------------------------------------------------------*/
+void log_shutdown()
+{
+    if (!log_running) {
+        return;
+    }
+    log_running = false;
+    __atomic_store_n(&log_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(log_tid, NULL);
+    while (log_rings) {
+        LOGRING* next = log_rings->next;
+        free(log_rings);
+        log_rings = next;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+/* log_init                         Start the flusher thread.                */
+/*---------------------------------------------------------------------------*/
+void log_init()
+{
+    if (pthread_key_create(&log_key, log_release_ring) != 0 ||
+        pthread_create(&log_tid, NULL, log_flusher, NULL) != 0) {
+        fprintf(stderr, "%sError: Failed to start the logger.%s\n",
+                ERR_COLOR, RES_COLOR);
+        exit(EXIT_FAILURE);
+    }
+    log_running = true;
+    atexit(log_shutdown);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -87,12 +342,12 @@ void validate_input(argc, argv)
     char**      argv;               /* Arguments vector. */
 
 {
-    if (argc != (FILES_NO + 2)) {
-        pre_print_protocols();
-        printf(
-            "%sError: Invalid number of arguments. Expected %d, got %d\n%s",
+    if (argc < 3) {
+        log_printf(
+            "%sError: Invalid number of arguments. Expected at least %d, "
+            "got %d\n%s",
             ERR_COLOR,
-            FILES_NO + 2,
+            3,
             argc,
             RES_COLOR
         );
@@ -109,8 +364,7 @@ void validate_input(argc, argv)
             strcmp(extract_extension(filepath), "txt") != 0 &&
             strcmp(extract_extension(filepath), "") != 0
         ) {
-            pre_print_protocols();
-            printf(
+            log_printf(
                 "%sError: Given file %s is not a valid type.\n%s",
                 ERR_COLOR,
                 filepath,
@@ -124,8 +378,7 @@ void validate_input(argc, argv)
     */
     for (unsigned short i = 0; lastarg[i] != '\0'; i++) {
         if (isdigit(lastarg[i]) == 0) {
-            pre_print_protocols();
-            printf(
+            log_printf(
                 "%sError: N parameter is not valid.\n%s",
                 ERR_COLOR,
                 RES_COLOR
@@ -134,65 +387,53 @@ void validate_input(argc, argv)
     }
 }
 
+/*---------------------------------------------------------------------------*/
+/* take_file                        Take the next file off the work queue.   */
+/*                                  Return false once the queue is empty.    */
+/*---------------------------------------------------------------------------*/
+bool take_file(q, filepath)
+
+    WORKQUEUE*  q;                  /* The work queue. */
+    char**      filepath;           /* Where the file taken will be stored. */
+
+{
+    bool        found = false;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->next < q->count) {
+        *filepath   = q->files[q->next++];
+        found       = true;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return found;
+}
+
 /*---------------------------------------------------------------------------*/
 /* calc_matrix_sum                  Calculate the sum of the matrix that is  */
 /*                                  contained in a given file. The function  */
 /*                                  will ignore all non-positive numbers.    */
 /*---------------------------------------------------------------------------*/
-void* calc_matrix_sum(t_idx)
+bool calc_matrix_sum(t_idx, filepath)
 
-    size_t      t_idx;              /* The index of the current thread. */
+    size_t      t_idx;              /* The index of the current worker. */
+    const char* filepath;           /* The file to be summed. */
 
 {
-    pthread_t   cur_thread  = tids[t_idx];
     FILE*       file        = NULL;
-    char*       filepath    = files[t_idx];
-
-    /*
-    --  Lock the thread for critical section.
-    */
-    pthread_mutex_lock(&locks[t_idx]);
-    if (p == NULL) {
-        p           = (THREADDATA*)malloc(sizeof(THREADDATA));
-        p->creator  = cur_thread;
-    }
-    pthread_mutex_unlock(&locks[t_idx]);
-
-    if (p && p->creator == cur_thread) {
-        pre_print_protocols();
-        printf(
-            "This is thread #%lu and I created THREADDATA %s%p%s\n",
-            t_idx,
-            INFO_COLOR,
-            p,
-            RES_COLOR
-        );
-    }
-    else {
-        pre_print_protocols();
-        printf(
-            "This is thread #%lu and I can access the THREADDATA %s%p%s\n",
-            t_idx,
-            INFO_COLOR,
-            p,
-            RES_COLOR
-        );
-    }
 
     /*
     --  If the file does not exist, simply print error message and return.
     */
     if ((file = fopen(filepath, "r")) == NULL) {
-        pre_print_protocols();
-		printf(
-			"%sThread #%ld - Error: File not found!\n%s",
+        log_printf(
+			"%sThread #%ld - Error: File %s not found!\n%s",
 			ERR_COLOR,
             t_idx,
+            filepath,
 			RES_COLOR
 		);
         efound = true;              /* Flag that an error is encountered. */
-        pthread_exit(NULL);         /* Exit the thread. */
-        return NULL;
+        return false;
     }
     size_t  count   = 0;            /* Count the no. of numbers on a line. */
     size_t  row     = 1;            /* current row/line. */
@@ -214,8 +455,7 @@ void* calc_matrix_sum(t_idx)
             */
             if (!ignore) {
                 if (num < 0) {
-                    pre_print_protocols();
-                    printf(
+                    log_printf(
                         "%sThread #%lu - "
                         "Warning: Negative number %d found on line %ld "
                         "of file \"%s\".\n%s",
@@ -227,8 +467,11 @@ void* calc_matrix_sum(t_idx)
                         RES_COLOR
                     );
                 }
+                else if (atomic) {
+                    __atomic_fetch_add(&msum, num, __ATOMIC_RELAXED);
+                }
                 else {
-                    msum += num;
+                    partials[t_idx].sum += num;
                 }
             }
             /*
@@ -250,27 +493,295 @@ void* calc_matrix_sum(t_idx)
             ignore = false;         /* Reset ignore flag. */
         }
     }
+    fclose(file);                   /* Close the file. */
+    /*
+    --  In atomic mode msum is always current, so report the progress.
+    */
+    if (atomic) {
+        log_printf(
+            "Thread #%lu - Done with \"%s\", running sum is %lu\n",
+            t_idx,
+            filepath,
+            __atomic_load_n(&msum, __ATOMIC_RELAXED)
+        );
+    }
+    return true;
+}
+
+/*---------------------------------------------------------------------------*/
+/* pool_worker                      The routine of every pool worker. Keep   */
+/*                                  taking files off the work queue and sum  */
+/*                                  them until there is nothing left.        */
+/*---------------------------------------------------------------------------*/
+void* pool_worker(arg)
+
+    void*       arg;                /* The index of the current worker. */
+
+{
+    size_t      t_idx       = (size_t)arg;
+    pthread_t   cur_thread  = pthread_self();
+    char*       filepath;
 
     /*
-    --  Lock the thread for another critical section.
+    --  Lock the THREADDATA for critical section.
     */
-    pthread_mutex_lock(&locks[t_idx]);
+    pthread_mutex_lock(&plock);
+    if (p == NULL) {
+        p           = (THREADDATA*)malloc(sizeof(THREADDATA));
+        p->creator  = cur_thread;
+    }
+    pthread_mutex_unlock(&plock);
+
     if (p && p->creator == cur_thread) {
-        pre_print_protocols();
-        printf("This is thread #%lu and I delete THREADDATA\n", t_idx);
+        log_printf(
+            "This is thread #%lu and I created THREADDATA %s%p%s\n",
+            t_idx,
+            INFO_COLOR,
+            p,
+            RES_COLOR
+        );
+    }
+    else {
+        log_printf(
+            "This is thread #%lu and I can access the THREADDATA %s%p%s\n",
+            t_idx,
+            INFO_COLOR,
+            p,
+            RES_COLOR
+        );
+    }
+
+    while (take_file(&queue, &filepath)) {
+        calc_matrix_sum(t_idx, filepath);
+    }
+
+    /*
+    --  Lock the THREADDATA for another critical section.
+    */
+    pthread_mutex_lock(&plock);
+    if (p && p->creator == cur_thread) {
+        log_printf("This is thread #%lu and I delete THREADDATA\n", t_idx);
         free(p);
+        p = NULL;
     }
     else {
-        pre_print_protocols();
-        printf("This is thread #%lu and I can access the THREADDATA\n", t_idx);
+        log_printf("This is thread #%lu and I can access the THREADDATA\n", t_idx);
     }
-    pthread_mutex_unlock(&locks[t_idx]);
+    pthread_mutex_unlock(&plock);
 
-    fclose(file);                   /* Close the file. */
-    pthread_exit(NULL);             /* Exit the thread. */
     return NULL;
 }
 
+/*---------------------------------------------------------------------------*/
+/* align_to_line                    Move an offset of a mapped file to the   */
+/*                                  start of the line that follows it.       */
+/*---------------------------------------------------------------------------*/
+size_t align_to_line(data, size, offset)
+
+    const char* data;               /* The mapped file. */
+    size_t      size;               /* Size of the file. */
+    size_t      offset;             /* The offset to be aligned. */
+
+{
+    if (offset == 0) {
+        return 0;
+    }
+    if (offset >= size) {
+        return size;
+    }
+    /*
+    --  A range starts right after the newline at or before `offset`.
+    */
+    const char* newline = memchr(data + offset - 1, '\n', size - offset + 1);
+    return newline == NULL ? size : (size_t)(newline - data) + 1;
+}
+
+/*---------------------------------------------------------------------------*/
+/* count_chunk_rows                 Count the newlines inside a chunk, so    */
+/*                                  that the chunks after it know the global */
+/*                                  row number they start at.                */
+/*---------------------------------------------------------------------------*/
+void* count_chunk_rows(arg)
+
+    void*       arg;                /* The chunk to be counted. */
+
+{
+    CHUNK*      chunk   = (CHUNK*)arg;
+    const char* pos     = chunk->data + chunk->begin;
+    const char* end     = chunk->data + chunk->end;
+
+    chunk->rows = 0;
+    while ((pos = memchr(pos, '\n', end - pos)) != NULL) {
+        chunk->rows++;
+        pos++;
+    }
+    return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+/* sum_chunk                        Calculate the matrix sum over the lines  */
+/*                                  of a chunk, with the same column limit   */
+/*                                  and warnings as calc_matrix_sum.         */
+/*---------------------------------------------------------------------------*/
+void* sum_chunk(arg)
+
+    void*       arg;                /* The chunk to be summed. */
+
+{
+    CHUNK*      chunk   = (CHUNK*)arg;
+    const char* pos     = chunk->data + chunk->begin;
+    const char* end     = chunk->data + chunk->end;
+    size_t      count   = 0;        /* Count the no. of numbers on a line. */
+    size_t      row     = chunk->first_row;
+    unsigned long sum   = 0;        /* Kept local, chunks share cache lines. */
+
+    while (pos < end) {
+        if (*pos == '\n') {
+            row++;                  /* Increase the row number. */
+            count = 0;              /* Reset the numbers counted. */
+            pos++;
+            continue;
+        }
+        /*
+        --  Skip anything that does not start a number, including a lone '-'.
+        */
+        bool        negative    = (*pos == '-');
+        const char* digits      = negative ? pos + 1 : pos;
+        if (digits >= end || !isdigit(*digits)) {
+            pos++;
+            continue;
+        }
+        unsigned int value = 0;
+        while (digits < end && isdigit(*digits)) {
+            value = value * 10 + (*digits - '0');
+            digits++;
+        }
+        int num = negative ? (int)(0u - value) : (int)value;
+        pos = digits;
+        /*
+        --  Like the stdio path, the first number of a line is always read,
+            and the numbers past column N are ignored.
+        */
+        if (count == 0 || count < n) {
+            if (num < 0) {
+                log_printf(
+                    "%sThread #%lu - "
+                    "Warning: Negative number %d found on line %ld "
+                    "of file \"%s\".\n%s",
+                    WARN_COLOR,
+                    chunk->t_idx,
+                    num,
+                    row,
+                    chunk->filepath,
+                    RES_COLOR
+                );
+            }
+            else {
+                sum += num;
+            }
+        }
+        count++;
+    }
+    chunk->sum = sum;
+    return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+/* run_chunk_threads                Run a routine on every chunk, each on    */
+/*                                  its own thread, and wait for all of them.*/
+/*---------------------------------------------------------------------------*/
+bool run_chunk_threads(chunks, nchunks, routine)
+
+    CHUNK*      chunks;             /* The chunks to be processed. */
+    size_t      nchunks;            /* No. of chunks. */
+    void*       (*routine)(void*);  /* What to do with each chunk. */
+
+{
+    pthread_t   ctids[nchunks];     /* IDs of the chunk threads. */
+    size_t      started = 0;        /* No. of threads created. */
+    bool        ok      = true;
+
+    for (; started < nchunks; ++started) {
+        if (pthread_create(&ctids[started], NULL, routine, &chunks[started])
+            != EXIT_SUCCESS) {
+            ok = false;
+            break;
+        }
+    }
+    for (size_t i = 0; i < started; ++i) {
+        pthread_join(ctids[i], NULL);
+    }
+    return ok;
+}
+
+/*---------------------------------------------------------------------------*/
+/* calc_matrix_sum_chunked          Calculate the sum of the matrix in a     */
+/*                                  file by splitting it into line-aligned   */
+/*                                  ranges, one thread per core.             */
+/*---------------------------------------------------------------------------*/
+bool calc_matrix_sum_chunked(filepath)
+
+    const char* filepath;           /* Path to the file. */
+
+{
+    int         fd  = open(filepath, O_RDONLY);
+    struct stat st;
+
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        if (fd != -1) {
+            close(fd);
+        }
+        log_printf("%sError: File %s not found!\n%s", ERR_COLOR, filepath, RES_COLOR);
+        return false;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return true;
+    }
+    size_t      size = st.st_size;
+    const char* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        log_printf("%sError: Failed to map %s.\n%s", ERR_COLOR, filepath, RES_COLOR);
+        return false;
+    }
+    /*
+    --  One chunk per core, but never more chunks than bytes.
+    */
+    long    ncores  = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t  nchunks = ncores < 1 ? 1 : (size_t)ncores;
+    if (nchunks > size) {
+        nchunks = size;
+    }
+    CHUNK   chunks[nchunks];
+    for (size_t i = 0; i < nchunks; ++i) {
+        chunks[i].data      = data;
+        chunks[i].filepath  = filepath;
+        chunks[i].t_idx     = i;
+        chunks[i].begin     = align_to_line(data, size, size * i / nchunks);
+        chunks[i].end       = align_to_line(data, size, size * (i + 1) / nchunks);
+        chunks[i].sum       = 0;
+    }
+    /*
+    --  First pass: count the rows of every chunk to find where each one
+        starts. Second pass: sum the chunks, then reduce their results.
+    */
+    bool ok = run_chunk_threads(chunks, nchunks, count_chunk_rows);
+    size_t row = 1;
+    for (size_t i = 0; i < nchunks; ++i) {
+        chunks[i].first_row = row;
+        row += chunks[i].rows;
+    }
+    if (ok) {
+        ok = run_chunk_threads(chunks, nchunks, sum_chunk);
+    }
+    for (size_t i = 0; ok && i < nchunks; ++i) {
+        msum += chunks[i].sum;
+    }
+    munmap((void*)data, size);
+    return ok;
+}
+
                 /**********************************/
                 /*                                */
                 /*             M A I N            */
@@ -283,6 +794,25 @@ int main(argc, argv)
     char**      argv;               /* Arguments vector */
 
 {
+    /*
+    --  Start the logger before anything is printed.
+    */
+    log_init();
+    /*
+    --  Check for the optional chunked flag and drop it from the arguments.
+    */
+    while (argc > 1 && (strcmp(argv[1], CHUNK_FLAG) == 0 ||
+                        strcmp(argv[1], ATOMIC_FLAG) == 0)) {
+        if (strcmp(argv[1], CHUNK_FLAG) == 0) {
+            chunked = true;
+        }
+        else {
+            atomic = true;
+        }
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
     /*
     --  Validate the input arguments.
     */
@@ -299,69 +829,107 @@ int main(argc, argv)
     /*
     --  Initialize global variables.
     */
-    n = (int)strtol(argv[argc - 1], (char**)NULL, 10);
-    for (i = 0; i < FILES_NO; ++i) {
-        files[i] = *(argv + i);
-    }
+    n       = (int)strtol(argv[argc - 1], (char**)NULL, 10);
+    files   = argv;
+    nfiles  = argc - 1;
 
     /*
-    --  Initialize the locks and create the threads.
+    --  In chunked mode, each file in turn is spread over all the cores.
     */
-	for (i = 0; i < FILES_NO; ++i) {
-        if (efound) {
-            continue;
-        }
-        if (pthread_mutex_init(&locks[i], NULL) != 0) {
-            efound = true;
-            continue;
-        }
-        pre_print_protocols();
-        printf("%sCreating thread #%lu...%s\n", INFO_COLOR, i + 1, RES_COLOR);
-		ret_val = pthread_create(
-			&tids[i],
-			NULL,
-			calc_matrix_sum,
-            (void*)i
-		);
-        if (ret_val != EXIT_SUCCESS) {
-            pre_print_protocols();
-            printf(
-                "%sError: Failed to create thread #%lu.%s",
-                ERR_COLOR,
-                i + 1,
-                RES_COLOR
-            );
+    if (chunked) {
+        for (i = 0; i < nfiles; ++i) {
+            log_printf("%sSumming %s in chunks...%s\n", INFO_COLOR, files[i], RES_COLOR);
+            if (!calc_matrix_sum_chunked(files[i])) {
+                efound = true;
+            }
         }
-	}
+    }
     /*
-    --  Wait for the threads.
+    --  Otherwise, one worker per core takes files off the work queue.
     */
-    for (i = 0; i < FILES_NO; ++i) {
-        size_t no = i + 1;
-        pre_print_protocols();
-        printf("%sWaiting for thread #%lu...%s\n", INFO_COLOR, no, RES_COLOR);
-        ret_val = pthread_join(tids[i], NULL);
-        if (ret_val != EXIT_SUCCESS) {
-            pre_print_protocols();
-            printf(
-                "%sError: Failed to join thread #%lu.%s",
-                ERR_COLOR,
-                i + 1,
-                RES_COLOR
+    else {
+        long ncores = sysconf(_SC_NPROCESSORS_ONLN);
+        nworkers    = ncores < 1 ? 1 : (size_t)ncores;
+        if (nworkers > nfiles) {
+            nworkers = nfiles;
+        }
+        tids        = (pthread_t*)malloc(nworkers * sizeof(pthread_t));
+        partials    = (PARTIAL*)aligned_alloc(CACHE_LINE, nworkers * sizeof(PARTIAL));
+        queue.files = files;
+        queue.count = nfiles;
+        queue.next  = 0;
+        if (tids == NULL || partials == NULL ||
+            pthread_mutex_init(&queue.lock, NULL) != 0 ||
+            pthread_mutex_init(&plock, NULL) != 0) {
+            log_printf("%sError: Failed to set up the workers.%s\n", ERR_COLOR, RES_COLOR);
+            return EXIT_FAILURE;
+        }
+        memset(partials, 0, nworkers * sizeof(PARTIAL));
+        /*
+        --  Create the workers.
+        */
+        size_t started = 0;         /* No. of workers created. */
+        for (i = 0; i < nworkers; ++i) {
+            log_printf("%sCreating thread #%lu...%s\n", INFO_COLOR, i + 1, RES_COLOR);
+            ret_val = pthread_create(
+                &tids[i],
+                NULL,
+                pool_worker,
+                (void*)i
             );
-            continue;
+            if (ret_val != EXIT_SUCCESS) {
+                log_printf(
+                    "%sError: Failed to create thread #%lu.%s",
+                    ERR_COLOR,
+                    i + 1,
+                    RES_COLOR
+                );
+                efound = true;
+                break;
+            }
+            started++;
+        }
+        /*
+        --  Wait for the workers. They only exit once the queue is empty.
+        */
+        for (i = 0; i < started; ++i) {
+            size_t no = i + 1;
+            log_printf("%sWaiting for thread #%lu...%s\n", INFO_COLOR, no, RES_COLOR);
+            ret_val = pthread_join(tids[i], NULL);
+            if (ret_val != EXIT_SUCCESS) {
+                log_printf(
+                    "%sError: Failed to join thread #%lu.%s",
+                    ERR_COLOR,
+                    i + 1,
+                    RES_COLOR
+                );
+                continue;
+            }
+            log_printf("%sThread #%lu exited!%s\n", SUCC_COLOR, no, RES_COLOR);
+        }
+        /*
+        --  Reduce the partial sums once every worker is done.
+        */
+        for (i = 0; i < nworkers; ++i) {
+            msum += partials[i].sum;
+        }
+        /*
+        --  If no worker could be started, nothing was summed.
+        */
+        if (started == 0) {
+            efound = true;
         }
-        pre_print_protocols();
-        printf("%sThread #%lu exited!%s\n", SUCC_COLOR, no, RES_COLOR);
+        pthread_mutex_destroy(&queue.lock);
+        pthread_mutex_destroy(&plock);
+        free(tids);
+        free(partials);
     }
 
     if (efound) {
-        pre_print_protocols();
-        printf("\n%sError found! Program Failed.%s\n\n", ERR_COLOR, RES_COLOR);
+        log_printf("\n%sError found! Program Failed.%s\n\n", ERR_COLOR, RES_COLOR);
         return EXIT_FAILURE;
     }
-    pre_print_protocols();
-    printf("MATRIX SUM = %s%lu%s\n\n", SUCC_COLOR, msum, RES_COLOR);
+    log_printf("MATRIX SUM = %s%lu%s\n\n", SUCC_COLOR, msum, RES_COLOR);
 
     return EXIT_SUCCESS;
 }
\ No newline at end of file